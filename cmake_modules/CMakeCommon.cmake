@@ -3,7 +3,7 @@ include(CheckCCompilerFlag)
 
 IF (NOT ${CMAKE_CXX_COMPILER_ID} STREQUAL "MSVC")
     SET(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} -std=gnu99")
-    SET(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -std=c++11")
+    SET(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} -std=c++17")
 ENDIF ()
 
 # Ccache support
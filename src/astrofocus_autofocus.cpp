@@ -0,0 +1,228 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+
+#include "astrofocus_autofocus.h"
+
+/* ************************************************************************************ */
+
+bool AstrofocusAutofocus::start(int center, int coarse_step, int coarse_points, int fine_step, int fine_points, int min, int max)
+{
+    if (coarse_step <= 0 || fine_step <= 0 || coarse_points < 3 || fine_points < 3 || min >= max)
+        return false;
+
+    fineStep = fine_step;
+    finePoints = std::min(fine_points, AUTOFOCUS_MAX_POINTS);
+    lowerLimit = min;
+    upperLimit = max;
+
+    current = PHASE_COARSE;
+    plan(center, coarse_step, std::min(coarse_points, AUTOFOCUS_MAX_POINTS));
+
+    return planned >= 3;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusAutofocus::abort()
+{
+    current = PHASE_IDLE;
+    planned = handedOut = received = 0;
+}
+
+/* ************************************************************************************ */
+
+AstrofocusAutofocus::Phase AstrofocusAutofocus::phase() const
+{
+    return current;
+}
+
+bool AstrofocusAutofocus::active() const
+{
+    return current == PHASE_COARSE || current == PHASE_FINE;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusAutofocus::nextTarget(int *position)
+{
+    if (!active() || handedOut >= planned)
+        return false;
+
+    *position = positions[handedOut++];
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusAutofocus::addSample(int position, double hfr)
+{
+    if (!active())
+        return;
+
+    // Samples come back in the order the positions were handed out
+    for (int i = received; i < handedOut; i++)
+    {
+        if (positions[i] != position)
+            continue;
+
+        std::swap(positions[i], positions[received]);
+        samples[received++] = hfr;
+        break;
+    }
+
+    if (received == planned)
+        completeSweep();
+}
+
+/* ************************************************************************************ */
+
+int AstrofocusAutofocus::bestPosition() const
+{
+    return best;
+}
+
+double AstrofocusAutofocus::bestHfr() const
+{
+    return bestValue;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * The sweep always runs outwards, from the lowest position to the highest,
+ * so every sample is approached from the same side and the backlash is
+ * the same for all of them.
+ */
+void AstrofocusAutofocus::plan(int center, int step, int points)
+{
+    const int first = center - step * (points - 1) / 2;
+
+    planned = handedOut = received = 0;
+
+    for (int i = 0; i < points; i++)
+    {
+        const int position = std::max(lowerLimit, std::min(upperLimit, first + i * step));
+
+        if (planned == 0 || positions[planned - 1] != position)
+            positions[planned++] = position;
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusAutofocus::completeSweep()
+{
+    double position = 0, hfr = 0;
+
+    if (!fit(&position, &hfr))
+    {
+        current = PHASE_FAILED;
+        return;
+    }
+
+    best = std::lround(position);
+    bestValue = hfr;
+
+    if (current == PHASE_COARSE)
+    {
+        current = PHASE_FINE;
+        plan(best, fineStep, finePoints);
+    }
+    else
+        current = PHASE_DONE;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Least squares parabola through (x, hfr^2), the x are centered and scaled
+ * to keep the normal equations well conditioned. When the fit is not a
+ * minimum inside the sweep the best sample is used instead.
+ */
+bool AstrofocusAutofocus::fit(double *position, double *hfr) const
+{
+    int min_index = 0;
+    double mean = 0, scale = 1;
+    double sx[5] = {}, sy[3] = {};
+
+    for (int i = 0; i < received; i++)
+    {
+        mean += positions[i];
+
+        if (samples[i] < samples[min_index])
+            min_index = i;
+    }
+
+    if (received == 0 || samples[min_index] <= 0)
+        return false;
+
+    *position = positions[min_index];
+    *hfr = samples[min_index];
+
+    if (received < AUTOFOCUS_MIN_FIT)
+        return true;
+
+    mean /= received;
+
+    for (int i = 0; i < received; i++)
+        scale = std::max(scale, std::fabs(positions[i] - mean));
+
+    for (int i = 0; i < received; i++)
+    {
+        const double x = (positions[i] - mean) / scale;
+        const double y = samples[i] * samples[i];
+        double power = 1;
+
+        for (int k = 0; k < 5; k++, power *= x)
+        {
+            sx[k] += power;
+
+            if (k < 3)
+                sy[k] += power * y;
+        }
+    }
+
+    // | sx4 sx3 sx2 | |a|   |sy2|
+    // | sx3 sx2 sx1 | |b| = |sy1|
+    // | sx2 sx1 sx0 | |c|   |sy0|
+    const double det = sx[4] * (sx[2] * sx[0] - sx[1] * sx[1]) - sx[3] * (sx[3] * sx[0] - sx[1] * sx[2]) + sx[2] * (sx[3] * sx[1] - sx[2] * sx[2]);
+
+    if (std::fabs(det) < 1e-12)
+        return true;
+
+    const double a = (sy[2] * (sx[2] * sx[0] - sx[1] * sx[1]) - sx[3] * (sy[1] * sx[0] - sx[1] * sy[0]) + sx[2] * (sy[1] * sx[1] - sx[2] * sy[0])) / det;
+    const double b = (sx[4] * (sy[1] * sx[0] - sx[1] * sy[0]) - sy[2] * (sx[3] * sx[0] - sx[1] * sx[2]) + sx[2] * (sx[3] * sy[0] - sy[1] * sx[2])) / det;
+    const double c = (sx[4] * (sx[2] * sy[0] - sy[1] * sx[1]) - sx[3] * (sx[3] * sy[0] - sy[1] * sx[2]) + sy[2] * (sx[3] * sx[1] - sx[2] * sx[2])) / det;
+
+    if (a <= 0)
+        return true;
+
+    const double vertex = -b / (2 * a);
+
+    if (vertex < -1 || vertex > 1)
+        return true;
+
+    *position = mean + vertex * scale;
+    *hfr = std::sqrt(std::max(0., c - b * b / (4 * a)));
+
+    return true;
+}
@@ -0,0 +1,84 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_AUTOFOCUS_H
+
+    #define ASTROFOCUS_AUTOFOCUS_H
+
+    #define AUTOFOCUS_MAX_POINTS    32      // Samples in one sweep
+    #define AUTOFOCUS_MIN_FIT       5       // Fewer samples than this and the best one is taken as is
+
+    /**
+     * V-curve autofocus: a coarse sweep around the starting position, then
+     * a fine sweep around the coarse minimum. The star size follows a
+     * hyperbola around the focus, so a parabola is fitted on the squared
+     * HFR and its vertex is the best position.
+     *
+     * The engine only plans: it hands out the positions to expose at and
+     * takes the samples back, possibly late, so the next move can start as
+     * soon as an exposure ends, while its HFR is still being measured.
+     */
+    class AstrofocusAutofocus
+    {
+        public:
+            enum Phase
+            {
+                PHASE_IDLE,
+                PHASE_COARSE,
+                PHASE_FINE,
+                PHASE_DONE,
+                PHASE_FAILED
+            };
+
+            bool start(int center, int coarse_step, int coarse_points, int fine_step, int fine_points, int min, int max);
+            void abort();
+
+            Phase phase() const;
+            bool active() const;
+
+            // Next position of the current sweep, false if all of them have been handed out
+            bool nextTarget(int *position);
+
+            // HFR measured at a position handed out by nextTarget(), moves on to the next phase when the sweep is complete
+            void addSample(int position, double hfr);
+
+            int bestPosition() const;
+            double bestHfr() const;
+
+        private:
+            void plan(int center, int step, int points);
+            void completeSweep();
+            bool fit(double *position, double *hfr) const;
+
+            Phase current { PHASE_IDLE };
+
+            int positions[AUTOFOCUS_MAX_POINTS] {};
+            double samples[AUTOFOCUS_MAX_POINTS] {};
+            int planned { 0 };
+            int handedOut { 0 };
+            int received { 0 };
+
+            int fineStep { 0 };
+            int finePoints { 0 };
+            int lowerLimit { 0 };
+            int upperLimit { 0 };
+
+            int best { 0 };
+            double bestValue { 0 };
+    };
+#endif
@@ -0,0 +1,87 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "astrofocus_devices.h"
+#include "astrofocus_focuser.h"
+
+/* ************************************************************************************ */
+
+AstrofocusDevices::AstrofocusDevices()
+{
+    const char *env = getenv(DEVICES_ENV);
+    int count = env != nullptr ? atoi(env) : 1;
+
+    if (count < 1 || count > DEVICES_MAX)
+    {
+        fprintf(stderr, "AstrofocusDevices => %s must be between 1 and %d, serving one focuser\n", DEVICES_ENV, DEVICES_MAX);
+        count = 1;
+    }
+
+    for (int i = 0; i < count; i++)
+        focusers.emplace_back(new AstrofocusFocuser());
+
+    if (count == 1)
+        return;
+
+    // The first one keeps the default name, so its configuration carries over
+    for (int i = 0; i < count; i++)
+    {
+        char name[MESSAGE_MAX_LENGHT];
+
+        if (i == 0)
+            snprintf(name, MESSAGE_MAX_LENGHT, "%s", DEVICE_DEFAULT_NAME);
+        else
+            snprintf(name, MESSAGE_MAX_LENGHT, "%s %d", DEVICE_DEFAULT_NAME, i + 1);
+
+        focusers[i]->setDeviceName(name);
+        byName.emplace(focusers[i]->getDeviceName(), focusers[i].get());
+    }
+}
+
+AstrofocusDevices::~AstrofocusDevices()
+{
+}
+
+/* ************************************************************************************ */
+
+AstrofocusFocuser *AstrofocusDevices::find(const char *dev) const
+{
+    // Alone, the focuser may still be named by INDIDEV or by the first client, and it checks the name itself
+    if (focusers.size() == 1)
+        return focusers[0].get();
+
+    if (dev == nullptr)
+        return nullptr;
+
+    auto it = byName.find(dev);
+
+    return it != byName.end() ? it->second : nullptr;
+}
+
+int AstrofocusDevices::count() const
+{
+    return focusers.size();
+}
+
+AstrofocusFocuser *AstrofocusDevices::get(int index) const
+{
+    return focusers[index].get();
+}
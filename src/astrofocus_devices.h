@@ -0,0 +1,57 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_DEVICES_H
+
+    #define ASTROFOCUS_DEVICES_H
+
+    #include <memory>
+    #include <string_view>
+    #include <unordered_map>
+    #include <vector>
+
+    #define DEVICES_ENV         "ASTROFOCUS_DEVICES"    // Number of focusers served by the process
+    #define DEVICES_MAX         8
+
+    class AstrofocusFocuser;
+
+    /**
+     * The focusers hosted by one driver process. Each one has its own serial
+     * port and I/O worker, the INDI entry points find theirs by device name.
+     * A single focuser keeps the default name, so INDIDEV and the existing
+     * configurations still apply, and takes every call as before.
+     */
+    class AstrofocusDevices
+    {
+        public:
+            AstrofocusDevices();
+            ~AstrofocusDevices();
+
+            // nullptr if no hosted focuser has this name
+            AstrofocusFocuser *find(const char *dev) const;
+
+            int count() const;
+            AstrofocusFocuser *get(int index) const;
+
+        private:
+            std::vector<std::unique_ptr<AstrofocusFocuser>> focusers;
+
+            // Keys point to the names held by the focusers, which never change once set
+            std::unordered_map<std::string_view, AstrofocusFocuser *> byName;
+    };
+#endif
@@ -0,0 +1,221 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <algorithm>
+
+#include "astrofocus_diagnostics.h"
+
+/**************************************************************************************
+ ** Constructor
+ ***************************************************************************************/
+AstrofocusDiagnostics::AstrofocusDiagnostics()
+{
+    reset();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusDiagnostics::reset()
+{
+    for (int i = 0; i < COMMAND_COUNT; i++)
+    {
+        commands[i].count.store(0, std::memory_order_relaxed);
+        commands[i].errors.store(0, std::memory_order_relaxed);
+        commands[i].maxUs.store(0, std::memory_order_relaxed);
+
+        for (int j = 0; j < LATENCY_BUCKETS; j++)
+            commands[i].histogram[j].store(0, std::memory_order_relaxed);
+    }
+
+    bytesOut.store(0, std::memory_order_relaxed);
+    bytesIn.store(0, std::memory_order_relaxed);
+    batches.store(0, std::memory_order_relaxed);
+    timeouts.store(0, std::memory_order_relaxed);
+    resyncs.store(0, std::memory_order_relaxed);
+    staleReplies.store(0, std::memory_order_relaxed);
+    droppedLines.store(0, std::memory_order_relaxed);
+    coalesced.store(0, std::memory_order_relaxed);
+
+    changes.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**************************************************************************************
+ ** Worker side
+ ***************************************************************************************/
+void AstrofocusDiagnostics::recordBatch(uint32_t bytes_out)
+{
+    batches.fetch_add(1, std::memory_order_relaxed);
+    bytesOut.fetch_add(bytes_out, std::memory_order_relaxed);
+    changes.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusDiagnostics::recordBytesIn(uint32_t bytes)
+{
+    bytesIn.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusDiagnostics::recordReply(int code, uint32_t latency_us)
+{
+    if (code < 0 || code >= COMMAND_COUNT)
+        return;
+
+    CommandCounters &counters = commands[code];
+    int bucket = 0;
+
+    // Bucket i holds the latencies below 2^i microseconds
+    while (bucket < LATENCY_BUCKETS - 1 && (latency_us >> bucket) != 0)
+        bucket++;
+
+    counters.count.fetch_add(1, std::memory_order_relaxed);
+    counters.histogram[bucket].fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t max_us = counters.maxUs.load(std::memory_order_relaxed);
+
+    while (latency_us > max_us && !counters.maxUs.compare_exchange_weak(max_us, latency_us, std::memory_order_relaxed));
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusDiagnostics::recordTimeout(int code)
+{
+    timeouts.fetch_add(1, std::memory_order_relaxed);
+
+    if (code >= 0 && code < COMMAND_COUNT)
+    {
+        commands[code].count.fetch_add(1, std::memory_order_relaxed);
+        commands[code].errors.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusDiagnostics::recordRejected(int code)
+{
+    if (code >= 0 && code < COMMAND_COUNT)
+        commands[code].errors.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusDiagnostics::recordResync()
+{
+    resyncs.fetch_add(1, std::memory_order_relaxed);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusDiagnostics::recordStaleReplies(uint32_t count)
+{
+    staleReplies.fetch_add(count, std::memory_order_relaxed);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusDiagnostics::recordDroppedLines(uint32_t count)
+{
+    droppedLines.fetch_add(count, std::memory_order_relaxed);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusDiagnostics::recordCoalesced()
+{
+    coalesced.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**************************************************************************************
+ ** INDI side
+ ***************************************************************************************/
+AstrofocusDiagnostics::CommandStats AstrofocusDiagnostics::command(int code) const
+{
+    CommandStats stats {};
+
+    if (code < 0 || code >= COMMAND_COUNT)
+        return stats;
+
+    const CommandCounters &counters = commands[code];
+
+    stats.count = counters.count.load(std::memory_order_relaxed);
+    stats.errors = counters.errors.load(std::memory_order_relaxed);
+    stats.p50Ms = percentileMs(counters, 0.50);
+    stats.p99Ms = percentileMs(counters, 0.99);
+    stats.maxMs = counters.maxUs.load(std::memory_order_relaxed) / 1000.;
+
+    return stats;
+}
+
+/* ************************************************************************************ */
+
+AstrofocusDiagnostics::LinkStats AstrofocusDiagnostics::link() const
+{
+    LinkStats stats;
+
+    stats.bytesOut = bytesOut.load(std::memory_order_relaxed);
+    stats.bytesIn = bytesIn.load(std::memory_order_relaxed);
+    stats.batches = batches.load(std::memory_order_relaxed);
+    stats.timeouts = timeouts.load(std::memory_order_relaxed);
+    stats.resyncs = resyncs.load(std::memory_order_relaxed);
+    stats.staleReplies = staleReplies.load(std::memory_order_relaxed);
+    stats.droppedLines = droppedLines.load(std::memory_order_relaxed);
+    stats.coalesced = coalesced.load(std::memory_order_relaxed);
+
+    return stats;
+}
+
+/* ************************************************************************************ */
+
+uint32_t AstrofocusDiagnostics::generation() const
+{
+    return changes.load(std::memory_order_relaxed);
+}
+
+/* ************************************************************************************ */
+
+/**
+ * The percentile is the upper edge of the bucket where it falls, so the
+ * estimate is never better than reality by more than a factor of two.
+ */
+double AstrofocusDiagnostics::percentileMs(const CommandCounters &counters, double p) const
+{
+    uint32_t buckets[LATENCY_BUCKETS];
+    uint64_t total = 0, cumulative = 0;
+    const double max_ms = counters.maxUs.load(std::memory_order_relaxed) / 1000.;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        buckets[i] = counters.histogram[i].load(std::memory_order_relaxed);
+        total += buckets[i];
+    }
+
+    if (total == 0)
+        return 0;
+
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        cumulative += buckets[i];
+
+        if (cumulative >= p * total)
+            return std::min(max_ms, (1u << i) / 1000.);
+    }
+
+    return max_ms;
+}
@@ -0,0 +1,106 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_DIAGNOSTICS_H
+
+    #define ASTROFOCUS_DIAGNOSTICS_H
+
+    #include <atomic>
+    #include <cstdint>
+
+    #include "astrofocus_protocol.h"
+
+    #define LATENCY_BUCKETS     24      // Power of two buckets in microseconds, the last one is about 8 s
+
+    /**
+     * Always-on counters of the serial link. The worker thread records, the
+     * INDI thread reads and resets: every counter is a relaxed atomic, so
+     * recording costs a few uncontended increments and never takes a lock.
+     * A snapshot taken while the worker is recording may be off by the
+     * exchange in progress, which is fine for diagnostics.
+     */
+    class AstrofocusDiagnostics
+    {
+        public:
+            struct CommandStats
+            {
+                uint32_t count;
+                uint32_t errors;        // Timeouts and rejected commands
+                double p50Ms;
+                double p99Ms;
+                double maxMs;
+            };
+
+            struct LinkStats
+            {
+                uint64_t bytesOut;
+                uint64_t bytesIn;
+                uint32_t batches;
+                uint32_t timeouts;
+                uint32_t resyncs;
+                uint32_t staleReplies;
+                uint32_t droppedLines;
+                uint32_t coalesced;
+            };
+
+            AstrofocusDiagnostics();
+
+            void reset();
+
+            // Worker side
+            void recordBatch(uint32_t bytes_out);
+            void recordBytesIn(uint32_t bytes);
+            void recordReply(int code, uint32_t latency_us);
+            void recordTimeout(int code);
+            void recordRejected(int code);
+            void recordResync();
+            void recordStaleReplies(uint32_t count);
+            void recordDroppedLines(uint32_t count);
+            void recordCoalesced();
+
+            // INDI side
+            CommandStats command(int code) const;
+            LinkStats link() const;
+
+            // Changes whenever something is recorded, cheap way to skip unchanged publications
+            uint32_t generation() const;
+
+        private:
+            struct CommandCounters
+            {
+                std::atomic<uint32_t> count;
+                std::atomic<uint32_t> errors;
+                std::atomic<uint32_t> maxUs;
+                std::atomic<uint32_t> histogram[LATENCY_BUCKETS];
+            };
+
+            double percentileMs(const CommandCounters &counters, double p) const;
+
+            CommandCounters commands[COMMAND_COUNT];
+
+            std::atomic<uint64_t> bytesOut;
+            std::atomic<uint64_t> bytesIn;
+            std::atomic<uint32_t> batches;
+            std::atomic<uint32_t> timeouts;
+            std::atomic<uint32_t> resyncs;
+            std::atomic<uint32_t> staleReplies;
+            std::atomic<uint32_t> droppedLines;
+            std::atomic<uint32_t> coalesced;
+            std::atomic<uint32_t> changes;
+    };
+#endif
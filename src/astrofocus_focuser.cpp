@@ -51,19 +51,31 @@
 
  ***********************************************************************************/
 
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
 #include <cmath>
 #include <cstring>
-#include <memory>
+#include <ctime>
+#include <fcntl.h>
 #include <string>
 #include <termios.h>
 #include <unistd.h>
 
+#include <eventloop.h>
 #include <indicom.h>
 #include "connectionplugins/connectionserial.h"
 
+#include "astrofocus_devices.h"
 #include "astrofocus_focuser.h"
+#include "astrofocus_protocol.h"
 
-static std::unique_ptr<AstrofocusFocuser> astrofocusFocuser(new AstrofocusFocuser());
+static AstrofocusDevices astrofocusDevices;
+
+static double monotonicSeconds()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 /**************************************************************************************
  ** Constructor
@@ -93,7 +105,7 @@ AstrofocusFocuser::~AstrofocusFocuser()
  ***************************************************************************************/
 const char * AstrofocusFocuser::getDefaultName()
 {
-    return "Astrofocus";
+    return DEVICE_DEFAULT_NAME;
 }
 
 /**************************************************************************************
@@ -126,529 +138,3351 @@ bool AstrofocusFocuser::initProperties()
     IUFillSwitchVector(&StepperModeSP, StepperModeS, STEPPER_MODE_COUNT, getDeviceName(),
                        "STEPPER_MODE", "Stepper Mode", MAIN_CONTROL_TAB, IP_RW, ISR_1OFMANY,
                        60, IPS_IDLE);
-    
-    return true;
-}
-
-/**************************************************************************************
- ** 
- ***************************************************************************************/
-bool AstrofocusFocuser::updateProperties()
-{
-    INDI::Focuser::updateProperties();
-    
-    if (isConnected())
-    {
-        loadSettingsFromDevice();
-        
-        defineProperty(&StepSizeNP);
-        defineProperty(&FirmwareVersionTP);
-        defineProperty(&StepperModeSP);
-    }
-    else
-    {
-        deleteProperty(StepSizeNP.name);
-        deleteProperty(FirmwareVersionTP.name);
-        deleteProperty(StepperModeSP.name);
-    }
-    
-    return true;
-}
 
-/**************************************************************************************
- ** Return properties of device.
- ***************************************************************************************/
-void ISGetProperties (const char *dev)
-{
-    astrofocusFocuser->ISGetProperties(dev);
-}
+    // -------
 
-void AstrofocusFocuser::ISGetProperties(const char *dev)
-{
-    if (dev != nullptr && strcmp(dev, getDeviceName()) != 0)
-        return;
+    IUFillNumber(&MotorSettingsN[MOTOR_STEPPER_POWER], "STEPPER_POWER", "Stepper power [1-255]", "%.0f", 1., 255., 1., 0.);
+    IUFillNumber(&MotorSettingsN[MOTOR_PULSES_DURATION], "PULSES_DURATION", "Pulses duration [ms]", "%.0f", 0., 65535., 1., 0.);
+    IUFillNumber(&MotorSettingsN[MOTOR_POWER_CUT_PAUSE], "POWER_CUT_PAUSE", "Power cut pause [ms]", "%.0f", 0., 65535., 1., 0.);
+    IUFillNumberVector(&MotorSettingsNP, MotorSettingsN, MOTOR_SETTINGS_COUNT, getDeviceName(), "MOTOR_SETTINGS", "Motor",
+                       MAIN_CONTROL_TAB, IP_RW, 0, IPS_IDLE);
 
-    INDI::Focuser::ISGetProperties(dev);
+    // -------
 
-    //defineSwitch(&ModeSP);
-    //loadConfig(true, "Mode");
-}
+    IUFillSwitch(&ReloadSettingsS[0], "RELOAD", "Reload", ISS_OFF);
+    IUFillSwitchVector(&ReloadSettingsSP, ReloadSettingsS, 1, getDeviceName(), "RELOAD_SETTINGS", "Device settings",
+                       MAIN_CONTROL_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
 
-/**************************************************************************************
- ** Process new switch from client
- ***************************************************************************************/
-void ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int num)
-{
-    astrofocusFocuser->ISNewSwitch(dev, name, states, names, num);
-}
+    // -------
 
-bool AstrofocusFocuser::ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int n)
-{
-    if (dev != nullptr && strcmp(dev, getDeviceName()) == 0)
-    {
-        if (!strcmp(name, StepperModeSP.name))
-        {
-            int currentIndex = IUFindOnSwitchIndex(&StepperModeSP);
+    IUFillNumber(&TemperatureN[0], "TEMPERATURE", "Celsius", "%6.2f", -50., 70., 0., 0.);
+    IUFillNumberVector(&TemperatureNP, TemperatureN, 1, getDeviceName(), "FOCUS_TEMPERATURE", "Temperature",
+                       TEMPERATURE_TAB, IP_RO, 0, IPS_IDLE);
 
-            switch (currentIndex)
-            {
-                case STEPPER_MODE_ONE_PHASE_FULL_STEP:
-                {
-                    sendCommand("13,1");
-                    break;
-                }
-                case STEPPER_MODE_TWO_PHASE_FULL_STEP:
-                {
-                    sendCommand("13,2");
-                    break;
-                }
-                case STEPPER_MODE_HALF_STEP:
-                {
-                    sendCommand("13,3");
-                    break;
-                }
-                default:
-                {
-                    StepperModeSP.s = IPS_ALERT;
-                    IDSetSwitch(&StepperModeSP, "AstrofocusFocuser::ISNewSwitch => Unknown mode index %d", currentIndex);
-                    return true;
-                }
-            }
- 
-            if(!receivedAck())
-            {
-                StepperModeSP.s = IPS_ALERT;
-                IDSetSwitch(&StepperModeSP, "AstrofocusFocuser::ISNewSwitch => Ack not received for index %d", currentIndex);
-                return false;
-            }
+    // -------
 
-            IUUpdateSwitch(&StepperModeSP, states, names, n);
-            currentIndex = IUFindOnSwitchIndex(&StepperModeSP);
-            StepperModeSP.s = IPS_OK;
-            IDSetSwitch(&StepperModeSP, NULL);
+    IUFillSwitch(&TemperatureCompensationS[TEMPERATURE_COMPENSATION_OFF], "OFF", "Off", ISS_ON);
+    IUFillSwitch(&TemperatureCompensationS[TEMPERATURE_COMPENSATION_FIRMWARE], "FIRMWARE", "Firmware", ISS_OFF);
+    IUFillSwitch(&TemperatureCompensationS[TEMPERATURE_COMPENSATION_DRIVER], "DRIVER", "Driver (predictive)", ISS_OFF);
+    IUFillSwitchVector(&TemperatureCompensationSP, TemperatureCompensationS, TEMPERATURE_COMPENSATION_COUNT, getDeviceName(),
+                       "TEMP_COMPENSATION_MODE", "Compensation", TEMPERATURE_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
 
-            DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::ISNewSwitch => The new value is %s", StepperModeS[currentIndex].label);
-            
-            return true;
-        }
-    }
+    // -------
 
-    return INDI::Focuser::ISNewSwitch(dev, name, states, names, n);
-}
- 
-/**************************************************************************************
- ** Process new text from client
- ***************************************************************************************/
-void ISNewText (const char *dev, const char *name, char *texts[], char *names[], int n)
-{
-    astrofocusFocuser->ISNewText(dev, name, texts, names, n);
-}
+    IUFillNumber(&TemperatureCoefficientN[0], "FIRMWARE_COEFFICIENT", "Firmware coefficient", "%.0f", -32768., 32767., 1., 0.);
+    IUFillNumberVector(&TemperatureCoefficientNP, TemperatureCoefficientN, 1, getDeviceName(), "TEMP_COEFFICIENT",
+                       "Coefficient", TEMPERATURE_TAB, IP_RW, 0, IPS_IDLE);
 
-/**************************************************************************************
- ** Process new number from client
- ***************************************************************************************/
-void ISNewNumber (const char *dev, const char *name, double values[], char *names[], int n)
-{
-    astrofocusFocuser->ISNewNumber(dev, name, values, names, n);
-}
- 
-/**************************************************************************************
- ** Process new blob from client
- ***************************************************************************************/
-void ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int n)
-{
-    INDI_UNUSED(dev);
-    INDI_UNUSED(name);
-    INDI_UNUSED(sizes);
-    INDI_UNUSED(blobsizes);
-    INDI_UNUSED(blobs);
-    INDI_UNUSED(formats);
-    INDI_UNUSED(names);
-    INDI_UNUSED(n);
-}
- 
-/**************************************************************************************
- ** Process snooped property from another driver
- ***************************************************************************************/
-void ISSnoopDevice (XMLEle *root)
-{
-    astrofocusFocuser->ISSnoopDevice(root);
-}
+    // -------
 
-/* ************************************************************************************ */
+    IUFillNumber(&CompensationSettingsN[COMPENSATION_STEPS_PER_DEGREE], "STEPS_PER_DEGREE", "Steps per degree", "%.1f", -10000., 10000., 1., 0.);
+    IUFillNumber(&CompensationSettingsN[COMPENSATION_MIN_MOVE], "MIN_MOVE", "Min move [steps]", "%.0f", 1., 1000., 1., 10.);
+    IUFillNumber(&CompensationSettingsN[COMPENSATION_LEAD_TIME], "LEAD_TIME", "Lead time [s]", "%.0f", 0., 3600., 10., 300.);
+    IUFillNumberVector(&CompensationSettingsNP, CompensationSettingsN, COMPENSATION_SETTINGS_COUNT, getDeviceName(),
+                       "TEMP_COMPENSATION_SETTINGS", "Driver compensation", TEMPERATURE_TAB, IP_RW, 0, IPS_IDLE);
 
-bool AstrofocusFocuser::Handshake()
-{
-    int nbytes_read = 0, err_code = 0;
-    char response[MESSAGE_MAX_LENGHT];
-    char error_message[MAXRBUF];
+    // -------
 
-    tcflush(PortFD, TCIOFLUSH);
+    IUFillNumber(&LinkDiagnosticsN[LINK_BATCHES], "BATCHES", "Batches", "%.0f", 0., 0., 0., 0.);
+    IUFillNumber(&LinkDiagnosticsN[LINK_BYTES_OUT], "BYTES_OUT", "Bytes out", "%.0f", 0., 0., 0., 0.);
+    IUFillNumber(&LinkDiagnosticsN[LINK_BYTES_IN], "BYTES_IN", "Bytes in", "%.0f", 0., 0., 0., 0.);
+    IUFillNumber(&LinkDiagnosticsN[LINK_TIMEOUTS], "TIMEOUTS", "Timeouts", "%.0f", 0., 0., 0., 0.);
+    IUFillNumber(&LinkDiagnosticsN[LINK_RESYNCS], "RESYNCS", "Resyncs", "%.0f", 0., 0., 0., 0.);
+    IUFillNumber(&LinkDiagnosticsN[LINK_STALE_REPLIES], "STALE_REPLIES", "Stale replies", "%.0f", 0., 0., 0., 0.);
+    IUFillNumber(&LinkDiagnosticsN[LINK_DROPPED_LINES], "DROPPED_LINES", "Dropped lines", "%.0f", 0., 0., 0., 0.);
+    IUFillNumber(&LinkDiagnosticsN[LINK_COALESCED], "COALESCED", "Coalesced queries", "%.0f", 0., 0., 0., 0.);
+    IUFillNumberVector(&LinkDiagnosticsNP, LinkDiagnosticsN, LINK_DIAGNOSTICS_COUNT, getDeviceName(), "SERIAL_DIAGNOSTICS", "Serial link",
+                       DIAGNOSTICS_TAB, IP_RO, 0, IPS_IDLE);
 
-    sendCommand("9,0");
+    // -------
 
-    if ((err_code = tty_read_section(PortFD, response, '\n', READ_TIMEOUT, &nbytes_read)) != TTY_OK)
+    static const char * const stats_names[COMMAND_STATS_PROPERTIES][2] =
     {
-        tty_error_msg(err_code, error_message, MAXRBUF);
+        { "COMMAND_COUNTS", "Commands" },
+        { "COMMAND_ERRORS", "Errors" },
+        { "COMMAND_LATENCY_P50", "Latency p50 [ms]" },
+        { "COMMAND_LATENCY_P99", "Latency p99 [ms]" },
+        { "COMMAND_LATENCY_MAX", "Latency max [ms]" }
+    };
+
+    for (int i = 0; i < COMMAND_STATS_PROPERTIES; i++)
+    {
+        const char *format = (i == COMMAND_STATS_COUNT || i == COMMAND_STATS_ERRORS) ? "%.0f" : "%.3f";
 
-        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::Handshake => TTY read error detected: %s", error_message);
+        for (int code = 0; code < COMMAND_COUNT; code++)
+            IUFillNumber(&CommandStatsN[i][code], commandName(code), commandName(code), format, 0., 0., 0., 0.);
 
-        return false;
+        IUFillNumberVector(&CommandStatsNP[i], CommandStatsN[i], COMMAND_COUNT, getDeviceName(), stats_names[i][0], stats_names[i][1],
+                           DIAGNOSTICS_TAB, IP_RO, 0, IPS_IDLE);
     }
 
-    if (nbytes_read <= 0)
-        return false;
+    // -------
 
-    FirmwareVersionT[0].text = response;
-    defineProperty(&FirmwareVersionTP);
+    IUFillSwitch(&ResetDiagnosticsS[0], "RESET", "Reset", ISS_OFF);
+    IUFillSwitchVector(&ResetDiagnosticsSP, ResetDiagnosticsS, 1, getDeviceName(), "DIAGNOSTICS_RESET", "Counters",
+                       DIAGNOSTICS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
 
-    return true;
-}
+    // -------
 
-/**************************************************************************************
- ** Serial communications
- ***************************************************************************************/
-int AstrofocusFocuser::sendCommand(const char *cmd)
-{
-    int nbytes_written = 0, err_code = 0;
-    char err_msg[MAXRBUF];
-    char cmd_to_send[MESSAGE_MAX_LENGHT];
-    
-    strcpy(cmd_to_send, cmd);
-    strcat(cmd_to_send, "\n");
+    IUFillBLOB(&TelemetryB[0], "TELEMETRY_CSV", "Samples", ".csv");
+    IUFillBLOBVector(&TelemetryBP, TelemetryB, 1, getDeviceName(), "TELEMETRY", "Telemetry", DIAGNOSTICS_TAB, IP_RO, 60, IPS_IDLE);
 
-    tcflush(PortFD, TCIOFLUSH);
+    IUFillSwitch(&TelemetryExportS[0], "EXPORT", "Export", ISS_OFF);
+    IUFillSwitchVector(&TelemetryExportSP, TelemetryExportS, 1, getDeviceName(), "TELEMETRY_EXPORT", "Telemetry export",
+                       DIAGNOSTICS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
 
-    if ((err_code = tty_write_string(PortFD, cmd_to_send, &nbytes_written) != TTY_OK))
-    {
-        tty_error_msg(err_code, err_msg, MAXRBUF);
+    IUFillSwitch(&TelemetryStreamS[TELEMETRY_STREAM_ON], "ON", "On", ISS_OFF);
+    IUFillSwitch(&TelemetryStreamS[TELEMETRY_STREAM_OFF], "OFF", "Off", ISS_ON);
+    IUFillSwitchVector(&TelemetryStreamSP, TelemetryStreamS, TELEMETRY_STREAM_COUNT, getDeviceName(), "TELEMETRY_STREAM",
+                       "Telemetry stream", DIAGNOSTICS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
 
-        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::sendCommand => cmd_to_send: %s", cmd_to_send);
-        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::sendCommand => TTY error detected: %s", err_msg);
-        return -1;
-    }
+    // -------
 
-    DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::sendCommand => Command sent successfully: %s", cmd_to_send);
+    IUFillNumber(&PublishLimitsN[PUBLISH_POSITION_DEADBAND], "POSITION_DEADBAND", "Position deadband [steps]", "%.0f", 0., 1000., 1., 0.);
+    IUFillNumber(&PublishLimitsN[PUBLISH_TEMPERATURE_DEADBAND], "TEMPERATURE_DEADBAND", "Temperature deadband [C]", "%.2f", 0., 5., 0.01, 0.05);
+    IUFillNumber(&PublishLimitsN[PUBLISH_MIN_INTERVAL], "MIN_INTERVAL", "Min interval [ms]", "%.0f", 0., 10000., 100., PUBLISH_MIN_MS);
+    IUFillNumber(&PublishLimitsN[PUBLISH_MAX_INTERVAL], "MAX_INTERVAL", "Max interval [ms]", "%.0f", 0., 600000., 1000., PUBLISH_MAX_MS);
+    IUFillNumberVector(&PublishLimitsNP, PublishLimitsN, PUBLISH_LIMITS_COUNT, getDeviceName(), "PUBLISH_LIMITS", "Client updates",
+                       OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
 
-    return nbytes_written;
-}
+    applyPublishLimits();
 
-/* ************************************************************************************ */
+    // -------
 
-bool AstrofocusFocuser::receivedAck()
-{
-    char *response;
-    bool res = false;
-    
-    response = receiveResponse();
+    IUFillSwitch(&ExposureGuardS[EXPOSURE_GUARD_ON], "ON", "Hold corrections", ISS_ON);
+    IUFillSwitch(&ExposureGuardS[EXPOSURE_GUARD_OFF], "OFF", "Move at once", ISS_OFF);
+    IUFillSwitchVector(&ExposureGuardSP, ExposureGuardS, EXPOSURE_GUARD_COUNT, getDeviceName(), "EXPOSURE_GUARD",
+                       "During exposures", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
 
-    if (response == NULL)
-    {
-        free(response);
-        return res;
-    }
-    
-    res = strcmp(response, "OK");
-    free(response);
+    IUFillNumber(&ExposureHoldN[0], "MAX_HOLD", "Max hold [s]", "%.0f", 10., 7200., 10., EXPOSURE_HOLD_MAX_S);
+    IUFillNumberVector(&ExposureHoldNP, ExposureHoldN, 1, getDeviceName(), "EXPOSURE_HOLD", "Exposure guard",
+                       OPTIONS_TAB, IP_RW, 0, IPS_IDLE);
 
-    return res;
-}
+    IUFillNumber(&HeldCorrectionN[0], "STEPS", "Steps", "%.0f", -65535., 65535., 1., 0.);
+    IUFillNumberVector(&HeldCorrectionNP, HeldCorrectionN, 1, getDeviceName(), "HELD_CORRECTION", "Held correction",
+                       OPTIONS_TAB, IP_RO, 0, IPS_IDLE);
 
-/* ************************************************************************************ */
+    // -------
 
-char * AstrofocusFocuser::receiveResponse()
-{
-    int nbytes_read = 0, err_code = 0;
-    char error_message[MAXRBUF];
-    char *response = (char *)calloc(MESSAGE_MAX_LENGHT, sizeof(char));
+    IUFillSwitch(&SharedStatusS[SHARED_STATUS_ON], "ON", "On", ISS_OFF);
+    IUFillSwitch(&SharedStatusS[SHARED_STATUS_OFF], "OFF", "Off", ISS_ON);
+    IUFillSwitchVector(&SharedStatusSP, SharedStatusS, SHARED_STATUS_COUNT, getDeviceName(), "SHARED_STATUS",
+                       "Shared status", OPTIONS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
 
-    tcflush(PortFD, TCIOFLUSH);
+    // -------
 
-    if ((err_code = tty_read_section(PortFD, response, '\n', READ_TIMEOUT, &nbytes_read)) != TTY_OK)
-    {
-        tty_error_msg(err_code, error_message, MAXRBUF);
+    IUFillText(&AutofocusCameraT[AUTOFOCUS_CAMERA_DEVICE], "DEVICE", "Camera", "CCD Simulator");
+    IUFillText(&AutofocusCameraT[AUTOFOCUS_CAMERA_PROPERTY], "PROPERTY", "HFR property", "FOCUS_HFR");
+    IUFillText(&AutofocusCameraT[AUTOFOCUS_CAMERA_ELEMENT], "ELEMENT", "HFR element", "HFR");
+    IUFillTextVector(&AutofocusCameraTP, AutofocusCameraT, AUTOFOCUS_CAMERA_COUNT, getDeviceName(), "AUTOFOCUS_CAMERA", "Camera",
+                     AUTOFOCUS_TAB, IP_RW, 0, IPS_IDLE);
 
-        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::receiveResult => TTY read error detected: %s", error_message);
+    // -------
 
-        return NULL;
-    }
+    IUFillNumber(&AutofocusSettingsN[AUTOFOCUS_COARSE_STEP], "COARSE_STEP", "Coarse step", "%.0f", 1., 10000., 10., 200.);
+    IUFillNumber(&AutofocusSettingsN[AUTOFOCUS_COARSE_POINTS], "COARSE_POINTS", "Coarse points", "%.0f", 3., AUTOFOCUS_MAX_POINTS, 1., 9.);
+    IUFillNumber(&AutofocusSettingsN[AUTOFOCUS_FINE_STEP], "FINE_STEP", "Fine step", "%.0f", 1., 10000., 10., 40.);
+    IUFillNumber(&AutofocusSettingsN[AUTOFOCUS_FINE_POINTS], "FINE_POINTS", "Fine points", "%.0f", 3., AUTOFOCUS_MAX_POINTS, 1., 9.);
+    IUFillNumberVector(&AutofocusSettingsNP, AutofocusSettingsN, AUTOFOCUS_SETTINGS_COUNT, getDeviceName(), "AUTOFOCUS_SETTINGS", "Sweep",
+                       AUTOFOCUS_TAB, IP_RW, 0, IPS_IDLE);
 
-    DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::receiveResult => Response: %s", response);
+    // -------
 
-    return response;
-}
+    IUFillSwitch(&AutofocusS[AUTOFOCUS_START], "START", "Start", ISS_OFF);
+    IUFillSwitch(&AutofocusS[AUTOFOCUS_ABORT], "ABORT", "Abort", ISS_OFF);
+    IUFillSwitchVector(&AutofocusSP, AutofocusS, AUTOFOCUS_COUNT, getDeviceName(), "AUTOFOCUS", "Autofocus",
+                       AUTOFOCUS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
 
-/* ************************************************************************************ */
+    // -------
 
-void AstrofocusFocuser::loadSettingsFromDevice()
-{
-    bool has_errors = false, has_temperature_sensor = false;
-    char *tmp_buffer;
-    int current_position = 0, current_upper_limit = 0, current_temperature_coefficient = 0,
-        current_step_size = 0, current_stepper_power = 0, current_pulses_duration = 0,
-        current_pause = 0, current_motion_mode = 0;
-    float current_temperature = 0;
+    IUFillNumber(&MoveEtaN[MOVE_ETA_REMAINING], "REMAINING", "Remaining [s]", "%.1f", 0., 0., 0., 0.);
+    IUFillNumber(&MoveEtaN[MOVE_ETA_STEP_TIME], "STEP_TIME", "Time per step [ms]", "%.2f", 0., 0., 0., 0.);
+    IUFillNumberVector(&MoveEtaNP, MoveEtaN, MOVE_ETA_COUNT, getDeviceName(), "FOCUS_ETA", "Move ETA",
+                       MAIN_CONTROL_TAB, IP_RO, 0, IPS_IDLE);
 
-    // Current position
-    sendCommand("0,0");
-    
-    tmp_buffer = receiveResponse();
-    current_position = stringToInt(tmp_buffer, &has_errors);
+    // -------
 
-    if (has_errors)
-        current_position = 0;
+    IUFillSwitch(&BacklashModeS[BACKLASH_OFF], "OFF", "Off", ISS_ON);
+    IUFillSwitch(&BacklashModeS[BACKLASH_FINAL_OUTWARD], "FINAL_OUTWARD", "Final approach outward", ISS_OFF);
+    IUFillSwitch(&BacklashModeS[BACKLASH_FINAL_INWARD], "FINAL_INWARD", "Final approach inward", ISS_OFF);
+    IUFillSwitchVector(&BacklashModeSP, BacklashModeS, BACKLASH_MODE_COUNT, getDeviceName(), "BACKLASH_MODE", "Backlash",
+                       FOCUS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
 
-    free(tmp_buffer);
+    // -------
 
-    // Current upper limit
-    sendCommand("4,0");
-    
-    tmp_buffer = receiveResponse();
-    current_upper_limit = stringToInt(tmp_buffer, &has_errors);
+    IUFillNumber(&BacklashSettingsN[BACKLASH_INWARD], "INWARD", "Inward [steps]", "%.0f", 0., 5000., 1., 0.);
+    IUFillNumber(&BacklashSettingsN[BACKLASH_OUTWARD], "OUTWARD", "Outward [steps]", "%.0f", 0., 5000., 1., 0.);
+    IUFillNumber(&BacklashSettingsN[BACKLASH_MARGIN], "MARGIN", "Overshoot margin [steps]", "%.0f", 0., 5000., 1., 20.);
+    IUFillNumber(&BacklashSettingsN[BACKLASH_CALIBRATION_STEP], "CALIBRATION_STEP", "Calibration step", "%.0f", 10., 10000., 10., 200.);
+    IUFillNumberVector(&BacklashSettingsNP, BacklashSettingsN, BACKLASH_SETTINGS_COUNT, getDeviceName(), "BACKLASH_SETTINGS", "Backlash profile",
+                       FOCUS_TAB, IP_RW, 0, IPS_IDLE);
 
-    if (has_errors)
-        current_upper_limit = 0;
+    // -------
 
-    free(tmp_buffer);
-    
-    // Current temperature
-    sendCommand("5,0");
-    tmp_buffer = receiveResponse();
-
-    // T = Sensor is present, 5,1 to gather the temperature
-    // F = No sensor, so I can ignore it
-    if(strcmp(tmp_buffer, "T"))
-        has_temperature_sensor = true;
-    else if(strcmp(tmp_buffer, "F"))
-        has_temperature_sensor = false;
-    else
-    {
-        // This should never happens
-        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::loadSettingsFromDevice => 5,0 unknown response: %s", tmp_buffer);
-        has_temperature_sensor = false;
-    }
+    IUFillSwitch(&BacklashCalibrateS[0], "CALIBRATE", "Calibrate", ISS_OFF);
+    IUFillSwitchVector(&BacklashCalibrateSP, BacklashCalibrateS, 1, getDeviceName(), "BACKLASH_CALIBRATE", "Backlash calibration",
+                       FOCUS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
 
-    free(tmp_buffer);
+    // -------
+
+    IUFillNumber(&AutofocusResultN[AUTOFOCUS_RESULT_POSITION], "POSITION", "Best position", "%.0f", 0., 0., 0., 0.);
+    IUFillNumber(&AutofocusResultN[AUTOFOCUS_RESULT_HFR], "HFR", "Best HFR", "%.2f", 0., 0., 0., 0.);
+    IUFillNumberVector(&AutofocusResultNP, AutofocusResultN, AUTOFOCUS_RESULT_COUNT, getDeviceName(), "AUTOFOCUS_RESULT", "Result",
+                       AUTOFOCUS_TAB, IP_RO, 0, IPS_IDLE);
+
+    // -------
 
-    if (has_temperature_sensor)
+    // A zero setting is left as it is on the device
+    for (int i = 0; i < OPTICAL_TRAINS; i++)
     {
-        sendCommand("5,1");
-        tmp_buffer = receiveResponse();
-        
-        current_temperature = stringToFloat(tmp_buffer, &has_errors);
+        char name[MAXINDINAME];
+        char label[MAXINDILABEL];
 
-        if (has_errors)
-            current_temperature = 0;
+        snprintf(name, MAXINDINAME, "TRAIN_%d", i + 1);
+        snprintf(label, MAXINDILABEL, "Train %d", i + 1);
 
-        free(tmp_buffer);
-    }
-    
-    // Current temmperature coefficient
-    sendCommand("6,0");
-    tmp_buffer = receiveResponse();
-    current_temperature_coefficient = stringToInt(tmp_buffer, &has_errors);
+        IUFillText(&TrainNamesT[i], name, label, label);
+        IUFillSwitch(&TrainS[i], name, label, ISS_OFF);
 
-    if (has_errors)
-        current_temperature_coefficient = 0;
+        IUFillNumber(&TrainSettingsN[i][TRAIN_STEP_SIZE], "STEP_SIZE", "Step size", "%.0f", -32768., 32767., 1., 0.);
+        IUFillNumber(&TrainSettingsN[i][TRAIN_STEPPER_MODE], "STEPPER_MODE", "Stepper mode (1-3)", "%.0f", 0., STEPPER_MODE_COUNT, 1., 0.);
+        IUFillNumber(&TrainSettingsN[i][TRAIN_STEPPER_POWER], "STEPPER_POWER", "Stepper power", "%.0f", 0., 255., 1., 0.);
+        IUFillNumber(&TrainSettingsN[i][TRAIN_PULSES_DURATION], "PULSES_DURATION", "Pulses duration", "%.0f", 0., 65535., 1., 0.);
+        IUFillNumber(&TrainSettingsN[i][TRAIN_POWER_CUT_PAUSE], "POWER_CUT_PAUSE", "Power cut pause", "%.0f", 0., 65535., 1., 0.);
+        IUFillNumber(&TrainSettingsN[i][TRAIN_FOCUS_OFFSET], "FOCUS_OFFSET", "Focus offset [steps]", "%.0f", -65535., 65535., 1., 0.);
 
-    free(tmp_buffer);
+        snprintf(name, MAXINDINAME, "OPTICAL_TRAIN_%d", i + 1);
+        IUFillNumberVector(&TrainSettingsNP[i], TrainSettingsN[i], TRAIN_SETTINGS_COUNT, getDeviceName(), name, label,
+                           OPTICAL_TRAINS_TAB, IP_RW, 0, IPS_IDLE);
+    }
 
-    // Step size (1/100 micron)
-    sendCommand("8,0");
-    tmp_buffer = receiveResponse();
-    current_step_size = stringToInt(tmp_buffer, &has_errors);
+    IUFillTextVector(&TrainNamesTP, TrainNamesT, OPTICAL_TRAINS, getDeviceName(), "OPTICAL_TRAIN_NAMES", "Names",
+                     OPTICAL_TRAINS_TAB, IP_RW, 0, IPS_IDLE);
 
-    if (has_errors)
-        current_step_size = 0;
+    IUFillSwitchVector(&TrainSP, TrainS, OPTICAL_TRAINS, getDeviceName(), "OPTICAL_TRAIN", "Optical train",
+                       OPTICAL_TRAINS_TAB, IP_RW, ISR_ATMOST1, 60, IPS_IDLE);
 
-    StepSizeN[0].value = (current_step_size / 100);
-    /*StepSizeNP.s = IPS_OK;
+    IUFillSwitch(&TrainOffsetMoveS[TRAIN_OFFSET_MOVE_ON], "ON", "Move", ISS_ON);
+    IUFillSwitch(&TrainOffsetMoveS[TRAIN_OFFSET_MOVE_OFF], "OFF", "Don't move", ISS_OFF);
+    IUFillSwitchVector(&TrainOffsetMoveSP, TrainOffsetMoveS, TRAIN_OFFSET_MOVE_COUNT, getDeviceName(), "OPTICAL_TRAIN_OFFSET_MOVE",
+                       "Focus offset", OPTICAL_TRAINS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
 
-    if (IUUpdateNumber(&StepSizeNP, values, names, (current_step_size / 100)) == 0)
-        IDSetNumber(&StepSizeNP, nullptr);*/
+    // -------
 
-    free(tmp_buffer);
-    
-    // Stepper motor power (1-255)
-    sendCommand("10,0");
-    tmp_buffer = receiveResponse();
-    current_stepper_power = stringToInt(tmp_buffer, &has_errors);
+    IUFillText(&FilterWheelT[0], "DEVICE", "Filter wheel", "Filter Simulator");
+    IUFillTextVector(&FilterWheelTP, FilterWheelT, 1, getDeviceName(), "FILTER_WHEEL", "Filter wheel", FILTERS_TAB, IP_RW, 0, IPS_IDLE);
 
-    if (has_errors)
-        current_stepper_power = 0;
-    else
+    for (int i = 0; i < FILTER_SLOTS; i++)
     {
-        if(current_stepper_power > 255)
-        {
-            current_stepper_power = 255;
-            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::loadSettingsFromDevice => 10,0 value over the limit: %s", tmp_buffer);
-        }
-        else if(current_stepper_power < 0)
-        {
-            current_stepper_power = 0;
-            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::loadSettingsFromDevice => 10,0 value below the limit: %s", tmp_buffer);
-        }
-    }
-
-    free(tmp_buffer);
-    
-    // Pulses duration (milliseconds)
-    sendCommand("11,0");
-    tmp_buffer = receiveResponse();
-    current_pulses_duration = stringToInt(tmp_buffer, &has_errors);
+        char name[MAXINDINAME];
+        char label[MAXINDILABEL];
 
-    if (has_errors)
-        current_pulses_duration = 0;
+        snprintf(name, MAXINDINAME, "SLOT_%d", i + 1);
+        snprintf(label, MAXINDILABEL, "Slot %d", i + 1);
 
-    free(tmp_buffer);
-    
-    // Pause before power cutoff (milliseconds)
-    sendCommand("12,0");
-    tmp_buffer = receiveResponse();
-    current_pause = stringToInt(tmp_buffer, &has_errors);
+        IUFillNumber(&FilterOffsetN[i], name, label, "%.0f", -65535., 65535., 1., 0.);
+    }
 
-    if (has_errors)
-        current_pause = 0;
+    IUFillNumberVector(&FilterOffsetNP, FilterOffsetN, FILTER_SLOTS, getDeviceName(), "FILTER_OFFSETS", "Focus offsets [steps]",
+                       FILTERS_TAB, IP_RW, 0, IPS_IDLE);
 
-    free(tmp_buffer);
+    IUFillSwitch(&FilterOffsetMoveS[FILTER_OFFSET_MOVE_ON], "ON", "Move", ISS_ON);
+    IUFillSwitch(&FilterOffsetMoveS[FILTER_OFFSET_MOVE_OFF], "OFF", "Don't move", ISS_OFF);
+    IUFillSwitchVector(&FilterOffsetMoveSP, FilterOffsetMoveS, FILTER_OFFSET_MOVE_COUNT, getDeviceName(), "FILTER_OFFSET_MOVE",
+                       "Focus offset", FILTERS_TAB, IP_RW, ISR_1OFMANY, 60, IPS_IDLE);
     
-    // Motion mode
-    sendCommand("13,0");
-    tmp_buffer = receiveResponse();
-    current_motion_mode = stringToInt(tmp_buffer, &has_errors);
+    return true;
+}
 
-    if (has_errors)
-        current_motion_mode = 1;
+/**************************************************************************************
+ ** 
+ ***************************************************************************************/
+bool AstrofocusFocuser::updateProperties()
+{
+    INDI::Focuser::updateProperties();
+    
+    if (isConnected())
+    {
+        // The cache is dropped on disconnect, so this only talks to the device after a reconnect
+        if (!settingsCache.isLoaded() && !resumeSettings())
+            loadSettingsFromDevice();
 
-    StepperModeS[STEPPER_MODE_ONE_PHASE_FULL_STEP].s = ISS_OFF;
-    StepperModeS[STEPPER_MODE_TWO_PHASE_FULL_STEP].s = ISS_OFF;
-    StepperModeS[STEPPER_MODE_HALF_STEP].s = ISS_OFF;
+        // From now on the serial port belongs to the worker thread
+        serialWorker.start(PortFD, &AstrofocusFocuser::onSerialCompletion, this);
+        
+        defineProperty(&StepSizeNP);
+        defineProperty(&FirmwareVersionTP);
+        defineProperty(&StepperModeSP);
+        defineProperty(&MotorSettingsNP);
+        defineProperty(&ReloadSettingsSP);
+        defineProperty(&MoveEtaNP);
 
-    switch(current_motion_mode)
-    {
-        case 1:
-        {
-            StepperModeS[STEPPER_MODE_ONE_PHASE_FULL_STEP].s = ISS_ON;
-            break;
-        }
-        case 2:
+        if (hasTemperatureSensor)
         {
-            StepperModeS[STEPPER_MODE_TWO_PHASE_FULL_STEP].s = ISS_ON;
-            break;
-        }
-        case 3:
-        {
-            StepperModeS[STEPPER_MODE_HALF_STEP].s = ISS_ON;
-            break;
+            defineProperty(&TemperatureNP);
+            defineProperty(&TemperatureCoefficientNP);
+            defineProperty(&TemperatureCompensationSP);
+            defineProperty(&CompensationSettingsNP);
+
+            loadConfig(true, CompensationSettingsNP.name);
+            loadConfig(true, TemperatureCompensationSP.name);
         }
-    }
-    
-    StepperModeSP.s = IPS_OK;
-    IDSetSwitch(&StepperModeSP, nullptr);
 
-    free(tmp_buffer);
-    
-    // -------
+        defineProperty(&LinkDiagnosticsNP);
 
-    FocusSpeedN[0].min = 0.;
-    FocusSpeedN[0].max = 0.;
-    FocusSpeedN[0].value = 0.;
-    FocusSpeedN[0].step = 0.;
-    FocusSpeedNP.s = IPS_OK;
+        for (int i = 0; i < COMMAND_STATS_PROPERTIES; i++)
+            defineProperty(&CommandStatsNP[i]);
 
-    IDSetNumber(&FocusSpeedNP, nullptr);
+        defineProperty(&ResetDiagnosticsSP);
+        defineProperty(&TelemetryBP);
+        defineProperty(&TelemetryExportSP);
+        defineProperty(&TelemetryStreamSP);
 
-    // -------
+        loadConfig(true, TelemetryStreamSP.name);
 
-    FocusTimerN[0].min = 0.;
-    FocusTimerN[0].max = 0.;
-    FocusTimerN[0].value = 0.;
-    FocusTimerN[0].step = 0.;
-    FocusTimerNP.s = IPS_OK;
+        defineProperty(&PublishLimitsNP);
+        loadConfig(true, PublishLimitsNP.name);
 
-    IDSetNumber(&FocusTimerNP, nullptr);
+        // The clients of the new connection start from scratch
+        applyPublishLimits();
 
-    // -------
+        defineProperty(&AutofocusCameraTP);
+        defineProperty(&AutofocusSettingsNP);
+        defineProperty(&AutofocusSP);
+        defineProperty(&AutofocusResultNP);
 
-    FocusAbsPosN[0].min = 0.;
-    FocusAbsPosN[0].max = 0.;
-    FocusAbsPosN[0].value = 0.;
-    FocusAbsPosN[0].step = 0.;
-    FocusAbsPosNP.s = IPS_OK;
+        defineProperty(&BacklashModeSP);
+        defineProperty(&BacklashSettingsNP);
+        defineProperty(&BacklashCalibrateSP);
 
-    IDSetNumber(&FocusAbsPosNP, nullptr);
+        loadConfig(true, AutofocusCameraTP.name);
+        loadConfig(true, AutofocusSettingsNP.name);
+        loadConfig(true, BacklashModeSP.name);
+        loadConfig(true, BacklashSettingsNP.name);
 
-    // -------
+        defineProperty(&TrainSP);
+        defineProperty(&TrainOffsetMoveSP);
+        defineProperty(&TrainNamesTP);
 
-    FocusMaxPosN[0].min = 0.;
-    FocusMaxPosN[0].max = current_upper_limit;
-    FocusMaxPosN[0].value = current_position;
-    FocusMaxPosN[0].step = 0.;
-    FocusMaxPosNP.s = IPS_OK;
+        for (int i = 0; i < OPTICAL_TRAINS; i++)
+            defineProperty(&TrainSettingsNP[i]);
 
-    IDSetNumber(&FocusMaxPosNP, nullptr);
+        loadConfig(true, TrainNamesTP.name);
+        loadConfig(true, TrainOffsetMoveSP.name);
 
-    // -------
+        for (int i = 0; i < OPTICAL_TRAINS; i++)
+            loadConfig(true, TrainSettingsNP[i].name);
 
-    FocusSyncN[0].min = 0.;
-    FocusSyncN[0].max = 0.;
-    FocusSyncN[0].value = 0.;
-    FocusSyncN[0].step = 0.;
-    FocusSyncNP.s = IPS_OK;
+        // Only the choice comes back, the device keeps the settings it already has
+        restoringTrain = true;
+        loadConfig(true, TrainSP.name);
+        restoringTrain = false;
 
-    IDSetNumber(&FocusSyncNP, nullptr);
-}
+        defineProperty(&FilterWheelTP);
+        defineProperty(&FilterOffsetMoveSP);
+        defineProperty(&FilterOffsetNP);
 
-int AstrofocusFocuser::stringToInt(const char *str, bool * has_errors)
-{
-    int ret = 0;
+        loadConfig(true, FilterWheelTP.name);
+        loadConfig(true, FilterOffsetMoveSP.name);
+        loadConfig(true, FilterOffsetNP.name);
 
-    try
-    {
-        ret = std::stoi(str);
-        *has_errors = false;
+        snoopFilterWheel();
 
-        DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::stringToInt => str: %s converted to %d.", str, ret);
-    }
-    catch (std::invalid_argument const &e)
-    {
-        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::stringToInt => invalid_argument: %s", e.what());
-        ret = 0;
-        *has_errors = true;
-    }
-    catch (std::out_of_range const &e)
-    {
-        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::stringToInt => out_of_range: %s", e.what());
-        ret = 0;
-        *has_errors = true;
-    }
+        defineProperty(&ExposureGuardSP);
+        defineProperty(&ExposureHoldNP);
+        defineProperty(&HeldCorrectionNP);
 
-    return ret;
-}
+        loadConfig(true, ExposureGuardSP.name);
+        loadConfig(true, ExposureHoldNP.name);
 
-float AstrofocusFocuser::stringToFloat(const char *str, bool * has_errors)
+        correctionHeld = false;
+        heldOffset = 0;
+        snoopCamera();
+
+        defineProperty(&SharedStatusSP);
+        loadConfig(true, SharedStatusSP.name);
+
+        publishSettings();
+        publishDiagnostics(true);
+
+        schedulePoll(getCurrentPollingPeriod());
+    }
+    else
+    {
+        if (pollTimerID != -1)
+        {
+            RemoveTimer(pollTimerID);
+            pollTimerID = -1;
+        }
+
+        if (reconnectTimerID != -1)
+        {
+            IERmTimer(reconnectTimerID);
+            reconnectTimerID = -1;
+        }
+
+        // A settings write cut short leaves the device state unknown. While the link was down the snapshot was already saved
+        if (settingsTransaction.count > 0)
+            remove(snapshotPath().c_str());
+        else if (serialWorker.isRunning())
+            saveSnapshot();
+
+        serialWorker.stop();
+        serialWorker.stopRecording();
+        settingsCache.invalidate();
+
+        settingsTransaction.count = 0;
+        queuedSettingsCount = 0;
+        moveInProgress = false;
+        moveCommandPending = false;
+        abortPending = false;
+        queuedTarget = -1;
+        positionQueryPending = false;
+        temperatureQueryPending = false;
+
+        autofocus.abort();
+        autofocusPendingCount = 0;
+        calibrationStep = -1;
+        approachTarget = -1;
+
+        deleteProperty(StepSizeNP.name);
+        deleteProperty(FirmwareVersionTP.name);
+        deleteProperty(StepperModeSP.name);
+        deleteProperty(MotorSettingsNP.name);
+        deleteProperty(ReloadSettingsSP.name);
+        deleteProperty(MoveEtaNP.name);
+        deleteProperty(LinkDiagnosticsNP.name);
+
+        for (int i = 0; i < COMMAND_STATS_PROPERTIES; i++)
+            deleteProperty(CommandStatsNP[i].name);
+
+        deleteProperty(ResetDiagnosticsSP.name);
+        deleteProperty(TelemetryBP.name);
+        deleteProperty(TelemetryExportSP.name);
+        deleteProperty(TelemetryStreamSP.name);
+        deleteProperty(PublishLimitsNP.name);
+        deleteProperty(AutofocusCameraTP.name);
+        deleteProperty(AutofocusSettingsNP.name);
+        deleteProperty(AutofocusSP.name);
+        deleteProperty(AutofocusResultNP.name);
+        deleteProperty(BacklashModeSP.name);
+        deleteProperty(BacklashSettingsNP.name);
+        deleteProperty(BacklashCalibrateSP.name);
+        deleteProperty(TrainSP.name);
+        deleteProperty(TrainOffsetMoveSP.name);
+        deleteProperty(TrainNamesTP.name);
+
+        for (int i = 0; i < OPTICAL_TRAINS; i++)
+            deleteProperty(TrainSettingsNP[i].name);
+
+        deleteProperty(FilterWheelTP.name);
+        deleteProperty(FilterOffsetMoveSP.name);
+        deleteProperty(FilterOffsetNP.name);
+        deleteProperty(ExposureGuardSP.name);
+        deleteProperty(ExposureHoldNP.name);
+        deleteProperty(HeldCorrectionNP.name);
+        deleteProperty(SharedStatusSP.name);
+
+        sharedStatus.close();
+
+        if (hasTemperatureSensor)
+        {
+            deleteProperty(TemperatureNP.name);
+            deleteProperty(TemperatureCoefficientNP.name);
+            deleteProperty(TemperatureCompensationSP.name);
+            deleteProperty(CompensationSettingsNP.name);
+        }
+    }
+    
+    return true;
+}
+
+/**************************************************************************************
+ ** Return properties of device.
+ ***************************************************************************************/
+void ISGetProperties (const char *dev)
+{
+    // No device means all of them
+    if (dev == nullptr)
+    {
+        for (int i = 0; i < astrofocusDevices.count(); i++)
+            astrofocusDevices.get(i)->ISGetProperties(dev);
+
+        return;
+    }
+
+    if (AstrofocusFocuser *focuser = astrofocusDevices.find(dev))
+        focuser->ISGetProperties(dev);
+}
+
+void AstrofocusFocuser::ISGetProperties(const char *dev)
+{
+    if (dev != nullptr && strcmp(dev, getDeviceName()) != 0)
+        return;
+
+    INDI::Focuser::ISGetProperties(dev);
+
+    //defineSwitch(&ModeSP);
+    //loadConfig(true, "Mode");
+}
+
+/**************************************************************************************
+ ** Process new switch from client
+ ***************************************************************************************/
+void ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int num)
+{
+    if (AstrofocusFocuser *focuser = astrofocusDevices.find(dev))
+        focuser->ISNewSwitch(dev, name, states, names, num);
+}
+
+bool AstrofocusFocuser::ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int n)
+{
+    if (dev != nullptr && strcmp(dev, getDeviceName()) == 0)
+    {
+        if (!strcmp(name, StepperModeSP.name))
+        {
+            IUUpdateSwitch(&StepperModeSP, states, names, n);
+
+            // Motion modes are 1-based on the firmware side
+            const SettingsWrite writes[] = { { COMMAND_MOTION_MODE, IUFindOnSwitchIndex(&StepperModeSP) + 1 } };
+
+            if (!applySettings(writes, 1))
+                revertSettings(writes, 1, IPS_ALERT);
+
+            return true;
+        }
+
+        if (!strcmp(name, ReloadSettingsSP.name))
+        {
+            IUResetSwitch(&ReloadSettingsSP);
+            reloadSettings();
+
+            return true;
+        }
+
+        if (!strcmp(name, AutofocusSP.name))
+        {
+            IUUpdateSwitch(&AutofocusSP, states, names, n);
+
+            const int index = IUFindOnSwitchIndex(&AutofocusSP);
+
+            IUResetSwitch(&AutofocusSP);
+
+            // Stopping the motor stops the sweep too
+            if (index == AUTOFOCUS_ABORT)
+            {
+                if (autofocus.active() || autofocusFinalMove)
+                    AbortFocuser();
+
+                return true;
+            }
+
+            if (index == AUTOFOCUS_START && !autofocus.active() && !startAutofocus())
+            {
+                AutofocusSP.s = IPS_ALERT;
+                IDSetSwitch(&AutofocusSP, nullptr);
+            }
+
+            return true;
+        }
+
+        if (!strcmp(name, BacklashModeSP.name))
+        {
+            IUUpdateSwitch(&BacklashModeSP, states, names, n);
+            BacklashModeSP.s = IPS_OK;
+            IDSetSwitch(&BacklashModeSP, nullptr);
+
+            return true;
+        }
+
+        if (!strcmp(name, BacklashCalibrateSP.name))
+        {
+            IUResetSwitch(&BacklashCalibrateSP);
+
+            if (calibrationStep < 0 && !startBacklashCalibration())
+            {
+                BacklashCalibrateSP.s = IPS_ALERT;
+                IDSetSwitch(&BacklashCalibrateSP, nullptr);
+            }
+
+            return true;
+        }
+
+        if (!strcmp(name, TrainSP.name))
+        {
+            const int previous = IUFindOnSwitchIndex(&TrainSP);
+
+            // At most one train is in use, the one just chosen
+            IUResetSwitch(&TrainSP);
+            IUUpdateSwitch(&TrainSP, states, names, n);
+
+            const int index = IUFindOnSwitchIndex(&TrainSP);
+
+            if (!restoringTrain && index >= 0 && !applyOpticalTrain(index, previous))
+            {
+                IUResetSwitch(&TrainSP);
+
+                if (previous >= 0)
+                    TrainS[previous].s = ISS_ON;
+
+                TrainSP.s = IPS_ALERT;
+                IDSetSwitch(&TrainSP, nullptr);
+
+                return true;
+            }
+
+            TrainSP.s = IPS_OK;
+            IDSetSwitch(&TrainSP, nullptr);
+
+            // The next offset move starts from the train in use, also after a restart
+            if (!restoringTrain)
+                saveConfig(true, TrainSP.name);
+
+            return true;
+        }
+
+        if (!strcmp(name, TrainOffsetMoveSP.name))
+        {
+            IUUpdateSwitch(&TrainOffsetMoveSP, states, names, n);
+            TrainOffsetMoveSP.s = IPS_OK;
+            IDSetSwitch(&TrainOffsetMoveSP, nullptr);
+
+            return true;
+        }
+
+        if (!strcmp(name, FilterOffsetMoveSP.name))
+        {
+            IUUpdateSwitch(&FilterOffsetMoveSP, states, names, n);
+            FilterOffsetMoveSP.s = IPS_OK;
+            IDSetSwitch(&FilterOffsetMoveSP, nullptr);
+
+            return true;
+        }
+
+        if (!strcmp(name, ExposureGuardSP.name))
+        {
+            IUUpdateSwitch(&ExposureGuardSP, states, names, n);
+            ExposureGuardSP.s = IPS_OK;
+            IDSetSwitch(&ExposureGuardSP, nullptr);
+
+            if (ExposureGuardS[EXPOSURE_GUARD_ON].s == ISS_ON)
+                snoopCamera();
+            else
+                releaseCorrection();
+
+            return true;
+        }
+
+        if (!strcmp(name, SharedStatusSP.name))
+        {
+            const int previousIndex = IUFindOnSwitchIndex(&SharedStatusSP);
+
+            IUUpdateSwitch(&SharedStatusSP, states, names, n);
+
+            if (!shareStatus(SharedStatusS[SHARED_STATUS_ON].s == ISS_ON))
+            {
+                IUResetSwitch(&SharedStatusSP);
+                SharedStatusS[previousIndex].s = ISS_ON;
+                SharedStatusSP.s = IPS_ALERT;
+                IDSetSwitch(&SharedStatusSP, "AstrofocusFocuser::ISNewSwitch => Unable to create the shared status: %s", strerror(errno));
+
+                return false;
+            }
+
+            SharedStatusSP.s = IPS_OK;
+            IDSetSwitch(&SharedStatusSP, nullptr);
+
+            return true;
+        }
+
+        if (!strcmp(name, TelemetryExportSP.name))
+        {
+            IUResetSwitch(&TelemetryExportSP);
+
+            if (exportTelemetry())
+            {
+                TelemetryExportSP.s = IPS_OK;
+                IDSetSwitch(&TelemetryExportSP, nullptr);
+            }
+            else
+            {
+                TelemetryExportSP.s = IPS_IDLE;
+                IDSetSwitch(&TelemetryExportSP, "No new telemetry since the last export");
+            }
+
+            return true;
+        }
+
+        if (!strcmp(name, TelemetryStreamSP.name))
+        {
+            IUUpdateSwitch(&TelemetryStreamSP, states, names, n);
+            TelemetryStreamSP.s = IPS_OK;
+            IDSetSwitch(&TelemetryStreamSP, nullptr);
+
+            return true;
+        }
+
+        if (!strcmp(name, ResetDiagnosticsSP.name))
+        {
+            IUResetSwitch(&ResetDiagnosticsSP);
+            serialWorker.getDiagnostics().reset();
+
+            ResetDiagnosticsSP.s = IPS_OK;
+            IDSetSwitch(&ResetDiagnosticsSP, nullptr);
+
+            publishDiagnostics(true);
+
+            return true;
+        }
+
+        if (!strcmp(name, TemperatureCompensationSP.name))
+        {
+            int previousIndex = IUFindOnSwitchIndex(&TemperatureCompensationSP);
+
+            IUUpdateSwitch(&TemperatureCompensationSP, states, names, n);
+
+            int currentIndex = IUFindOnSwitchIndex(&TemperatureCompensationSP);
+
+            // Only one of the two can run, the firmware one is switched off for the others
+            const char *cmd = (currentIndex == TEMPERATURE_COMPENSATION_FIRMWARE) ? commandText<COMMAND_TEMPERATURE_COMPENSATION, 1>()
+                                                                                  : commandText<COMMAND_TEMPERATURE_COMPENSATION, 0>();
+
+            if (!serialWorker.post(AstrofocusSerialWorker::REQUEST_COMMAND, SERIAL_TAG_TEMPERATURE_COMPENSATION, cmd))
+            {
+                IUResetSwitch(&TemperatureCompensationSP);
+                TemperatureCompensationS[previousIndex].s = ISS_ON;
+                TemperatureCompensationSP.s = IPS_ALERT;
+                IDSetSwitch(&TemperatureCompensationSP, "AstrofocusFocuser::ISNewSwitch => Unable to send %s", cmd);
+                return false;
+            }
+
+            if (currentIndex == TEMPERATURE_COMPENSATION_DRIVER)
+                resetTemperatureCompensation();
+
+            pendingCompensationIndex = previousIndex;
+            TemperatureCompensationSP.s = IPS_BUSY;
+            IDSetSwitch(&TemperatureCompensationSP, nullptr);
+
+            return true;
+        }
+    }
+
+    return INDI::Focuser::ISNewSwitch(dev, name, states, names, n);
+}
+ 
+/**************************************************************************************
+ ** Process new number from client
+ ***************************************************************************************/
+bool AstrofocusFocuser::ISNewNumber(const char *dev, const char *name, double values[], char *names[], int n)
+{
+    if (dev != nullptr && strcmp(dev, getDeviceName()) == 0)
+    {
+        // Device settings, written through a transaction and published again once the firmware has taken them
+        if (!strcmp(name, TemperatureCoefficientNP.name) || !strcmp(name, StepSizeNP.name) || !strcmp(name, MotorSettingsNP.name) ||
+                !strcmp(name, FocusMaxPosNP.name))
+        {
+            SettingsWrite writes[MOTOR_SETTINGS_COUNT];
+            int count = 0;
+            bool updated;
+
+            if (!strcmp(name, TemperatureCoefficientNP.name))
+            {
+                updated = IUUpdateNumber(&TemperatureCoefficientNP, values, names, n) == 0;
+                writes[count++] = { COMMAND_TEMPERATURE_COEFFICIENT, (int)TemperatureCoefficientN[0].value };
+            }
+            else if (!strcmp(name, StepSizeNP.name))
+            {
+                updated = IUUpdateNumber(&StepSizeNP, values, names, n) == 0;
+                writes[count++] = { COMMAND_STEP_SIZE, (int)StepSizeN[0].value };
+            }
+            else if (!strcmp(name, FocusMaxPosNP.name))
+            {
+                // Not through SetFocuserMaxPosition(): the base class would take the limit before the firmware does
+                updated = IUUpdateNumber(&FocusMaxPosNP, values, names, n) == 0;
+                writes[count++] = { COMMAND_UPPER_LIMIT, (int)FocusMaxPosN[0].value };
+            }
+            else
+            {
+                updated = IUUpdateNumber(&MotorSettingsNP, values, names, n) == 0;
+                writes[count++] = { COMMAND_STEPPER_POWER, (int)MotorSettingsN[MOTOR_STEPPER_POWER].value };
+                writes[count++] = { COMMAND_PULSES_DURATION, (int)MotorSettingsN[MOTOR_PULSES_DURATION].value };
+                writes[count++] = { COMMAND_PAUSE, (int)MotorSettingsN[MOTOR_POWER_CUT_PAUSE].value };
+            }
+
+            // Out of range values are refused by IUUpdateNumber, nothing is sent then
+            if (!updated || !applySettings(writes, count))
+                revertSettings(writes, count, IPS_ALERT);
+
+            return true;
+        }
+
+        if (!strcmp(name, CompensationSettingsNP.name))
+        {
+            IUUpdateNumber(&CompensationSettingsNP, values, names, n);
+            CompensationSettingsNP.s = IPS_OK;
+            IDSetNumber(&CompensationSettingsNP, nullptr);
+
+            return true;
+        }
+
+        if (!strcmp(name, BacklashSettingsNP.name))
+        {
+            IUUpdateNumber(&BacklashSettingsNP, values, names, n);
+            BacklashSettingsNP.s = IPS_OK;
+            IDSetNumber(&BacklashSettingsNP, nullptr);
+
+            return true;
+        }
+
+        if (!strcmp(name, AutofocusSettingsNP.name))
+        {
+            IUUpdateNumber(&AutofocusSettingsNP, values, names, n);
+            AutofocusSettingsNP.s = IPS_OK;
+            IDSetNumber(&AutofocusSettingsNP, nullptr);
+
+            return true;
+        }
+
+        for (int i = 0; i < OPTICAL_TRAINS; i++)
+        {
+            if (strcmp(name, TrainSettingsNP[i].name))
+                continue;
+
+            TrainSettingsNP[i].s = IUUpdateNumber(&TrainSettingsNP[i], values, names, n) == 0 ? IPS_OK : IPS_ALERT;
+            IDSetNumber(&TrainSettingsNP[i], nullptr);
+
+            return true;
+        }
+
+        if (!strcmp(name, PublishLimitsNP.name))
+        {
+            PublishLimitsNP.s = IUUpdateNumber(&PublishLimitsNP, values, names, n) == 0 ? IPS_OK : IPS_ALERT;
+            IDSetNumber(&PublishLimitsNP, nullptr);
+
+            applyPublishLimits();
+
+            return true;
+        }
+
+        if (!strcmp(name, FilterOffsetNP.name))
+        {
+            FilterOffsetNP.s = IUUpdateNumber(&FilterOffsetNP, values, names, n) == 0 ? IPS_OK : IPS_ALERT;
+            IDSetNumber(&FilterOffsetNP, nullptr);
+
+            return true;
+        }
+
+        if (!strcmp(name, ExposureHoldNP.name))
+        {
+            ExposureHoldNP.s = IUUpdateNumber(&ExposureHoldNP, values, names, n) == 0 ? IPS_OK : IPS_ALERT;
+            IDSetNumber(&ExposureHoldNP, nullptr);
+
+            return true;
+        }
+
+        // The user has just chosen a new focus point, the compensation starts over from here
+        if (!strcmp(name, FocusAbsPosNP.name) || !strcmp(name, FocusRelPosNP.name))
+        {
+            if (autofocus.active() || autofocusFinalMove)
+                stopAutofocus(IPS_ALERT, "Autofocus interrupted by a client move");
+
+            if (calibrationStep >= 0)
+                stopBacklashCalibration(IPS_ALERT, "Backlash calibration interrupted by a client move");
+
+            resetTemperatureCompensation();
+        }
+    }
+
+    return INDI::Focuser::ISNewNumber(dev, name, values, names, n);
+}
+
+/**************************************************************************************
+ ** Process new text from client
+ ***************************************************************************************/
+void ISNewText (const char *dev, const char *name, char *texts[], char *names[], int n)
+{
+    if (AstrofocusFocuser *focuser = astrofocusDevices.find(dev))
+        focuser->ISNewText(dev, name, texts, names, n);
+}
+
+bool AstrofocusFocuser::ISNewText(const char *dev, const char *name, char *texts[], char *names[], int n)
+{
+    if (dev != nullptr && strcmp(dev, getDeviceName()) == 0)
+    {
+        if (!strcmp(name, AutofocusCameraTP.name))
+        {
+            IUUpdateText(&AutofocusCameraTP, texts, names, n);
+            AutofocusCameraTP.s = IPS_OK;
+            IDSetText(&AutofocusCameraTP, nullptr);
+
+            if (ExposureGuardS[EXPOSURE_GUARD_ON].s == ISS_ON)
+                snoopCamera();
+
+            return true;
+        }
+
+        if (!strcmp(name, TrainNamesTP.name))
+        {
+            IUUpdateText(&TrainNamesTP, texts, names, n);
+            TrainNamesTP.s = IPS_OK;
+            IDSetText(&TrainNamesTP, nullptr);
+
+            updateOpticalTrainLabels();
+
+            return true;
+        }
+
+        if (!strcmp(name, FilterWheelTP.name))
+        {
+            IUUpdateText(&FilterWheelTP, texts, names, n);
+            FilterWheelTP.s = IPS_OK;
+            IDSetText(&FilterWheelTP, nullptr);
+
+            snoopFilterWheel();
+
+            return true;
+        }
+    }
+
+    return INDI::Focuser::ISNewText(dev, name, texts, names, n);
+}
+
+/**************************************************************************************
+ ** Process new number from client
+ ***************************************************************************************/
+void ISNewNumber (const char *dev, const char *name, double values[], char *names[], int n)
+{
+    if (AstrofocusFocuser *focuser = astrofocusDevices.find(dev))
+        focuser->ISNewNumber(dev, name, values, names, n);
+}
+ 
+/**************************************************************************************
+ ** Process new blob from client
+ ***************************************************************************************/
+void ISNewBLOB (const char *dev, const char *name, int sizes[], int blobsizes[], char *blobs[], char *formats[], char *names[], int n)
+{
+    INDI_UNUSED(dev);
+    INDI_UNUSED(name);
+    INDI_UNUSED(sizes);
+    INDI_UNUSED(blobsizes);
+    INDI_UNUSED(blobs);
+    INDI_UNUSED(formats);
+    INDI_UNUSED(names);
+    INDI_UNUSED(n);
+}
+ 
+/**************************************************************************************
+ ** Process snooped property from another driver
+ ***************************************************************************************/
+void ISSnoopDevice (XMLEle *root)
+{
+    // Snooped properties belong to other drivers, every focuser filters its own
+    for (int i = 0; i < astrofocusDevices.count(); i++)
+        astrofocusDevices.get(i)->ISSnoopDevice(root);
+}
+
+bool AstrofocusFocuser::ISSnoopDevice(XMLEle *root)
+{
+    const char *device = findXMLAttValu(root, "device");
+    const char *name = findXMLAttValu(root, "name");
+
+    if ((autofocus.active() || calibrationStep >= 0) && !strcmp(device, AutofocusCameraT[AUTOFOCUS_CAMERA_DEVICE].text))
+    {
+        IPState state = IPS_IDLE;
+
+        if (crackIPState(findXMLAttValu(root, "state"), &state) != 0)
+            state = IPS_OK;
+
+        if (!strcmp(name, "CCD_EXPOSURE"))
+            onExposureState(state);
+        else if (!strcmp(name, AutofocusCameraT[AUTOFOCUS_CAMERA_PROPERTY].text))
+        {
+            for (XMLEle *element = nextXMLEle(root, 1); element != nullptr; element = nextXMLEle(root, 0))
+            {
+                if (strcmp(findXMLAttValu(element, "name"), AutofocusCameraT[AUTOFOCUS_CAMERA_ELEMENT].text))
+                    continue;
+
+                // A frame without stars has no HFR, the sweep can't go on without it
+                onHfrMeasured(state == IPS_ALERT ? 0 : atof(pcdataXMLEle(element)));
+                break;
+            }
+        }
+    }
+
+    if (ExposureGuardS[EXPOSURE_GUARD_ON].s == ISS_ON && !strcmp(device, AutofocusCameraT[AUTOFOCUS_CAMERA_DEVICE].text) &&
+            !strcmp(name, "CCD_EXPOSURE"))
+    {
+        IPState state = IPS_IDLE;
+
+        if (crackIPState(findXMLAttValu(root, "state"), &state) != 0)
+            state = IPS_OK;
+
+        onCameraExposure(state);
+    }
+
+    if (!strcmp(device, FilterWheelT[0].text))
+    {
+        IPState state = IPS_IDLE;
+
+        if (crackIPState(findXMLAttValu(root, "state"), &state) != 0)
+            state = IPS_OK;
+
+        if (!strcmp(name, "FILTER_SLOT"))
+        {
+            for (XMLEle *element = nextXMLEle(root, 1); element != nullptr; element = nextXMLEle(root, 0))
+            {
+                if (!strcmp(findXMLAttValu(element, "name"), "FILTER_SLOT_VALUE"))
+                {
+                    onFilterSlot(atoi(pcdataXMLEle(element)), state);
+                    break;
+                }
+            }
+        }
+        else if (!strcmp(name, "FILTER_NAME"))
+            updateFilterLabels(root);
+    }
+
+    return INDI::Focuser::ISSnoopDevice(root);
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusFocuser::Handshake()
+{
+    static const char * const version_query[1] = { commandText<COMMAND_VERSION, 0>() };
+    char reply[1][MESSAGE_MAX_LENGHT];
+
+    serialWorker.setDeviceName(getDeviceName());
+    startCapture();
+
+    // The port was just opened: whatever is pending is boot noise, not a reply
+    tcflush(PortFD, TCIOFLUSH);
+
+    if (queryBatch(version_query, reply, 1) != 1 || !decodeReply<COMMAND_VERSION>(reply[0]))
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::Handshake => No reply to the version query");
+        return false;
+    }
+
+    IUSaveText(&FirmwareVersionT[0], reply[0]);
+    defineProperty(&FirmwareVersionTP);
+
+    return true;
+}
+
+/**************************************************************************************
+ ** Serial communications
+ ***************************************************************************************/
+int AstrofocusFocuser::queryBatch(const char * const cmds[], char responses[][MESSAGE_MAX_LENGHT], int count, int timeout)
+{
+    return serialWorker.transact(PortFD, cmds, responses, count, timeout);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::onSerialCompletion(const AstrofocusSerialWorker::Completion &completion, void *context)
+{
+    static_cast<AstrofocusFocuser *>(context)->handleCompletion(completion);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::handleCompletion(const AstrofocusSerialWorker::Completion &completion)
+{
+    if (!completion.success)
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::handleCompletion => %s failed, reply: %s", completion.command, completion.reply);
+
+    // Whatever was in flight is lost with the link, the reconnect starts over from a clean state
+    if (!completion.success && serialWorker.isLinkDown())
+    {
+        scheduleReconnect();
+        return;
+    }
+
+    switch (completion.tag)
+    {
+        case SERIAL_TAG_POSITION:
+        {
+            Expected<int> position = decodeReply<COMMAND_POSITION>(completion.reply);
+
+            positionQueryPending = false;
+            processPosition(position.value, completion.success && position);
+
+            if (completion.success && position)
+                recordTelemetry(std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - positionQueryTime).count());
+            break;
+        }
+        case SERIAL_TAG_MOVE:
+        {
+            moveCommandPending = false;
+
+            if (!completion.success)
+                finishMove(IPS_ALERT);
+            else if (queuedTarget >= 0 && !sendMove(queuedTarget))
+                finishMove(IPS_ALERT);
+            break;
+        }
+        case SERIAL_TAG_ABORT_POSITION:
+        {
+            char cmd[MESSAGE_MAX_LENGHT];
+            Expected<int> position = decodeReply<COMMAND_POSITION>(completion.reply);
+
+            abortPending = false;
+
+            // A move requested after the abort goes straight to its target instead
+            if (queuedTarget >= 0)
+            {
+                if (!sendMove(queuedTarget))
+                    finishMove(IPS_ALERT);
+                break;
+            }
+
+            if (!completion.success || !position)
+                break;
+
+            // The firmware has no stop command: the motor is sent to the position it has just reached
+            if (encodeCommand(cmd, MESSAGE_MAX_LENGHT, COMMAND_GOTO, position.value) > 0 &&
+                    serialWorker.post(AstrofocusSerialWorker::REQUEST_COMMAND, SERIAL_TAG_MOVE, cmd))
+            {
+                targetPosition = position.value;
+                moveCommandPending = true;
+            }
+            break;
+        }
+        case SERIAL_TAG_SETTINGS_WRITE:
+        {
+            if (!completion.success)
+                settingsTransaction.failed = true;
+
+            // The acks are checked all together, once the last one is in
+            if (settingsTransaction.pending > 0 && --settingsTransaction.pending == 0)
+                completeSettingsTransaction();
+            break;
+        }
+        case SERIAL_TAG_TEMPERATURE:
+        {
+            Expected<float> temperature = decodeReply<COMMAND_TEMPERATURE, 1>(completion.reply);
+
+            temperatureQueryPending = false;
+            processTemperature(temperature.value, completion.success && temperature);
+            break;
+        }
+        case SERIAL_TAG_SETTING_READ:
+        {
+            int code = 0, argument = 0;
+
+            if (completion.success && parseCommand(completion.command, &code, &argument))
+                storeSetting(code, completion.reply);
+
+            // The reload is complete: publish whatever has changed in one go
+            if (reloadPending > 0 && --reloadPending == 0)
+            {
+                publishSettings();
+                saveSnapshot();
+
+                ReloadSettingsSP.s = IPS_OK;
+                IDSetSwitch(&ReloadSettingsSP, nullptr);
+            }
+            break;
+        }
+        case SERIAL_TAG_TEMPERATURE_COMPENSATION:
+        {
+            if (!completion.success)
+            {
+                IUResetSwitch(&TemperatureCompensationSP);
+                TemperatureCompensationS[pendingCompensationIndex].s = ISS_ON;
+                TemperatureCompensationSP.s = IPS_ALERT;
+                IDSetSwitch(&TemperatureCompensationSP, "AstrofocusFocuser::handleCompletion => Ack not received for %s", completion.command);
+                break;
+            }
+
+            TemperatureCompensationSP.s = IPS_OK;
+            IDSetSwitch(&TemperatureCompensationSP, nullptr);
+            break;
+        }
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::loadSettingsFromDevice()
+{
+    static const int commands[] =
+    {
+        COMMAND_POSITION, COMMAND_UPPER_LIMIT, COMMAND_TEMPERATURE, COMMAND_TEMPERATURE_COEFFICIENT, COMMAND_STEP_SIZE,
+        COMMAND_STEPPER_POWER, COMMAND_PULSES_DURATION, COMMAND_PAUSE, COMMAND_MOTION_MODE
+    };
+
+    static const char * const queries[] =
+    {
+        commandText<COMMAND_POSITION, 0>(), commandText<COMMAND_UPPER_LIMIT, 0>(), commandText<COMMAND_TEMPERATURE, 0>(),
+        commandText<COMMAND_TEMPERATURE_COEFFICIENT, 0>(), commandText<COMMAND_STEP_SIZE, 0>(), commandText<COMMAND_STEPPER_POWER, 0>(),
+        commandText<COMMAND_PULSES_DURATION, 0>(), commandText<COMMAND_PAUSE, 0>(), commandText<COMMAND_MOTION_MODE, 0>()
+    };
+
+    const int query_count = sizeof(queries) / sizeof(queries[0]);
+    char replies[query_count][MESSAGE_MAX_LENGHT];
+
+    settingsCache.invalidate();
+
+    // All the read-only queries go out in one batch, so the connection costs a single round-trip
+    queryBatch(queries, replies, query_count);
+
+    for (int i = 0; i < query_count; i++)
+        storeSetting(commands[i], replies[i]);
+
+    settingsCache.markLoaded();
+
+    // Current temperature
+    if (settingsCache.valueOr(COMMAND_TEMPERATURE, 0) == 1)
+    {
+        static const char * const temperature_query[1] = { commandText<COMMAND_TEMPERATURE, 1>() };
+        char temperature_reply[1][MESSAGE_MAX_LENGHT];
+
+        queryBatch(temperature_query, temperature_reply, 1);
+        storeInitialTemperature(temperature_reply[0]);
+    }
+
+    finishSettingsLoad();
+    saveSnapshot();
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Fast path of the connection: the snapshot of the last session is trusted
+ * if the firmware version and the upper limit still match. Only the
+ * position, and the temperature, are read fresh, in a single batch.
+ */
+bool AstrofocusFocuser::resumeSettings()
+{
+    static const char * const queries[] =
+    {
+        commandText<COMMAND_POSITION, 0>(), commandText<COMMAND_UPPER_LIMIT, 0>(), commandText<COMMAND_TEMPERATURE, 1>()
+    };
+    char replies[3][MESSAGE_MAX_LENGHT];
+    int upper_limit = 0, has_sensor = 0;
+
+    if (!snapshot.isValid() && !snapshot.load(snapshotPath().c_str()))
+        return false;
+
+    if (strcmp(snapshot.firmware(), FirmwareVersionT[0].text) != 0 ||
+            !snapshot.get(COMMAND_UPPER_LIMIT, &upper_limit) || !snapshot.get(COMMAND_TEMPERATURE, &has_sensor))
+    {
+        DEBUG(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::resumeSettings => The snapshot is for another firmware, full reload");
+        return false;
+    }
+
+    const int query_count = has_sensor ? 3 : 2;
+
+    if (queryBatch(queries, replies, query_count) != query_count)
+        return false;
+
+    Expected<int> position = decodeReply<COMMAND_POSITION>(replies[0]);
+    Expected<int> limit = decodeReply<COMMAND_UPPER_LIMIT>(replies[1]);
+
+    if (!position || !limit || limit.value != upper_limit)
+    {
+        DEBUG(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::resumeSettings => The device has changed since the snapshot, full reload");
+        return false;
+    }
+
+    settingsCache.invalidate();
+    snapshot.restore(settingsCache);
+    settingsCache.set(COMMAND_POSITION, position.value);
+    settingsCache.markLoaded();
+
+    if (has_sensor)
+        storeInitialTemperature(replies[2]);
+
+    finishSettingsLoad();
+
+    DEBUG(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::resumeSettings => Settings restored from the last session");
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::storeInitialTemperature(const char *reply)
+{
+    Expected<float> temperature = decodeReply<COMMAND_TEMPERATURE, 1>(reply);
+
+    temperatureFilter.reset();
+
+    if (temperature)
+        temperatureFilter.add(temperature.value, monotonicSeconds());
+
+    TemperatureN[0].value = temperature.valueOr(0);
+    TemperatureNP.s = temperature ? IPS_OK : IPS_ALERT;
+    lastTemperaturePoll = std::chrono::steady_clock::now();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::finishSettingsLoad()
+{
+    hasTemperatureSensor = (settingsCache.valueOr(COMMAND_TEMPERATURE, 0) == 1);
+
+    if (!hasTemperatureSensor)
+        temperatureFilter.reset();
+
+    lastPosition = targetPosition = settingsCache.valueOr(COMMAND_POSITION, 0);
+
+    // -------
+
+    FocusSpeedN[0].min = 0.;
+    FocusSpeedN[0].max = 0.;
+    FocusSpeedN[0].value = 0.;
+    FocusSpeedN[0].step = 0.;
+    FocusSpeedNP.s = IPS_OK;
+
+    IDSetNumber(&FocusSpeedNP, nullptr);
+
+    // -------
+
+    FocusTimerN[0].min = 0.;
+    FocusTimerN[0].max = 0.;
+    FocusTimerN[0].value = 0.;
+    FocusTimerN[0].step = 0.;
+    FocusTimerNP.s = IPS_OK;
+
+    IDSetNumber(&FocusTimerNP, nullptr);
+
+    // -------
+
+    FocusSyncN[0].min = 0.;
+    FocusSyncN[0].max = 0.;
+    FocusSyncN[0].value = 0.;
+    FocusSyncN[0].step = 0.;
+    FocusSyncNP.s = IPS_OK;
+
+    IDSetNumber(&FocusSyncNP, nullptr);
+}
+
+/* ************************************************************************************ */
+
+// Next to the INDI configuration of the device
+std::string AstrofocusFocuser::snapshotPath() const
+{
+    const char *home = getenv("HOME");
+
+    return std::string(home != nullptr ? home : ".") + "/.indi/" + getDeviceName() + "_snapshot";
+}
+
+/**
+ * With CAPTURE_ENV set, the whole serial session is recorded, from the
+ * handshake to the disconnection, the reconnects included. See
+ * src/replay for how to play it back.
+ */
+void AstrofocusFocuser::startCapture()
+{
+    const char *directory = getenv(CAPTURE_ENV);
+    char stamp[32];
+    time_t now = time(nullptr);
+    struct tm local;
+
+    if (directory == nullptr || *directory == '\0' || serialWorker.isRecording())
+        return;
+
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime_r(&now, &local));
+
+    std::string path = std::string(directory) + "/" + getDeviceName() + "-" + stamp + ".afsession";
+
+    std::replace(path.begin() + strlen(directory) + 1, path.end(), ' ', '_');
+    serialWorker.startRecording(path.c_str());
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::saveSnapshot()
+{
+    if (!settingsCache.isLoaded())
+        return;
+
+    snapshot.capture(settingsCache, FirmwareVersionT[0].text);
+
+    if (!snapshot.save(snapshotPath().c_str()))
+        DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::saveSnapshot => Unable to write %s", snapshotPath().c_str());
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Validates a reply to one of the read commands and stores it in the cache.
+ * Returns false if the reply can't be used, the cached value is then kept.
+ */
+bool AstrofocusFocuser::storeSetting(int command, const char *reply)
+{
+    Expected<int> value;
+
+    switch (command)
+    {
+        case COMMAND_TEMPERATURE:
+        {
+            // T = Sensor is present, 5,1 to gather the temperature
+            // F = No sensor, so I can ignore it
+            Expected<bool> has_sensor = decodeReply<COMMAND_TEMPERATURE>(reply);
+
+            if (has_sensor)
+            {
+                settingsCache.set(command, has_sensor.value);
+                return true;
+            }
+
+            // This should never happens
+            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::storeSetting => 5,0 unknown response: %s", reply);
+            settingsCache.set(command, 0);
+            return false;
+        }
+        case COMMAND_STEPPER_POWER:
+        {
+            value = decodeReply<COMMAND_STEPPER_POWER>(reply);
+
+            if (value && (value.value < 0 || value.value > 255))
+            {
+                DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::storeSetting => 10,0 value out of the limits: %s", reply);
+                value.value = std::max(0, std::min(255, value.value));
+            }
+            break;
+        }
+        case COMMAND_MOTION_MODE:
+        {
+            value = decodeReply<COMMAND_MOTION_MODE>(reply);
+
+            // 0 would pass as the query, it's not a mode
+            if (value && !isWritableSetting(command, value.value))
+                value.valid = false;
+            break;
+        }
+        default:
+            // All the other settings are numbers
+            value = ReplyDecoder<REPLY_INT>::decode(reply);
+            break;
+    }
+
+    if (!value)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::storeSetting => Invalid reply to %d,0: %s", command, reply);
+        return false;
+    }
+
+    settingsCache.set(command, value.value);
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Pushes to the clients only the cached values that have changed since the
+ * last time they were published. Nothing here touches the serial port.
+ */
+void AstrofocusFocuser::publishSettings()
+{
+    int value;
+
+    if (settingsCache.isDirty(COMMAND_UPPER_LIMIT) && settingsCache.get(COMMAND_UPPER_LIMIT, &value))
+    {
+        FocusAbsPosN[0].min = 0.;
+        FocusAbsPosN[0].max = value;
+        FocusAbsPosN[0].step = 1.;
+
+        // Only a min/max update makes the clients take the new bounds, it carries the value as well
+        IUUpdateMinMax(&FocusAbsPosNP);
+        positionPublisher.sent(FocusAbsPosNP, std::chrono::steady_clock::now());
+
+        FocusRelPosN[0].min = 0.;
+        FocusRelPosN[0].max = value;
+        FocusRelPosN[0].step = 1.;
+        IUUpdateMinMax(&FocusRelPosNP);
+
+        FocusMaxPosN[0].min = 0.;
+        FocusMaxPosN[0].max = UPPER_LIMIT_MAX;
+        FocusMaxPosN[0].value = value;
+        FocusMaxPosN[0].step = 0.;
+        FocusMaxPosNP.s = IPS_OK;
+        IDSetNumber(&FocusMaxPosNP, nullptr);
+
+        settingsCache.clearDirty(COMMAND_UPPER_LIMIT);
+    }
+
+    if (settingsCache.isDirty(COMMAND_POSITION) && settingsCache.get(COMMAND_POSITION, &value))
+    {
+        FocusAbsPosN[0].value = value;
+        FocusAbsPosNP.s = IPS_OK;
+        publishNumber(&FocusAbsPosNP, positionPublisher, true);
+
+        settingsCache.clearDirty(COMMAND_POSITION);
+    }
+
+    if (settingsCache.isDirty(COMMAND_TEMPERATURE_COEFFICIENT) && settingsCache.get(COMMAND_TEMPERATURE_COEFFICIENT, &value))
+    {
+        TemperatureCoefficientN[0].value = value;
+        TemperatureCoefficientNP.s = IPS_OK;
+        IDSetNumber(&TemperatureCoefficientNP, nullptr);
+
+        settingsCache.clearDirty(COMMAND_TEMPERATURE_COEFFICIENT);
+    }
+
+    // Step size (1/100 micron)
+    if (settingsCache.isDirty(COMMAND_STEP_SIZE) && settingsCache.get(COMMAND_STEP_SIZE, &value))
+    {
+        StepSizeN[0].value = value;
+        StepSizeNP.s = IPS_OK;
+        IDSetNumber(&StepSizeNP, nullptr);
+
+        settingsCache.clearDirty(COMMAND_STEP_SIZE);
+    }
+
+    if (settingsCache.isDirty(COMMAND_STEPPER_POWER) || settingsCache.isDirty(COMMAND_PULSES_DURATION) ||
+            settingsCache.isDirty(COMMAND_PAUSE))
+    {
+        MotorSettingsN[MOTOR_STEPPER_POWER].value = settingsCache.valueOr(COMMAND_STEPPER_POWER, 0);
+        MotorSettingsN[MOTOR_PULSES_DURATION].value = settingsCache.valueOr(COMMAND_PULSES_DURATION, 0);
+        MotorSettingsN[MOTOR_POWER_CUT_PAUSE].value = settingsCache.valueOr(COMMAND_PAUSE, 0);
+        MotorSettingsNP.s = IPS_OK;
+        IDSetNumber(&MotorSettingsNP, nullptr);
+
+        settingsCache.clearDirty(COMMAND_STEPPER_POWER);
+        settingsCache.clearDirty(COMMAND_PULSES_DURATION);
+        settingsCache.clearDirty(COMMAND_PAUSE);
+
+        configureMotionModel();
+    }
+
+    // Motion mode, 1-based on the firmware side
+    if (settingsCache.isDirty(COMMAND_MOTION_MODE) && settingsCache.get(COMMAND_MOTION_MODE, &value) &&
+            value >= 1 && value <= STEPPER_MODE_COUNT)
+    {
+        IUResetSwitch(&StepperModeSP);
+        StepperModeS[value - 1].s = ISS_ON;
+        StepperModeSP.s = IPS_OK;
+        IDSetSwitch(&StepperModeSP, nullptr);
+
+        settingsCache.clearDirty(COMMAND_MOTION_MODE);
+
+        configureMotionModel();
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::reloadSettings()
+{
+    static const char * const queries[] =
+    {
+        commandText<COMMAND_UPPER_LIMIT, 0>(), commandText<COMMAND_TEMPERATURE_COEFFICIENT, 0>(), commandText<COMMAND_STEP_SIZE, 0>(),
+        commandText<COMMAND_STEPPER_POWER, 0>(), commandText<COMMAND_PULSES_DURATION, 0>(), commandText<COMMAND_PAUSE, 0>(),
+        commandText<COMMAND_MOTION_MODE, 0>()
+    };
+
+    const int query_count = sizeof(queries) / sizeof(queries[0]);
+
+    reloadPending = 0;
+
+    for (int i = 0; i < query_count; i++)
+    {
+        if (serialWorker.post(AstrofocusSerialWorker::REQUEST_QUERY, SERIAL_TAG_SETTING_READ, queries[i]))
+            reloadPending++;
+    }
+
+    ReloadSettingsSP.s = reloadPending > 0 ? IPS_BUSY : IPS_ALERT;
+    IDSetSwitch(&ReloadSettingsSP, nullptr);
+}
+
+/**************************************************************************************
+ ** Settings writes
+ ***************************************************************************************/
+
+/**
+ * Writes a set of settings as one transaction. Only the values that differ
+ * from the cached device state are sent, in a single write, and the acks
+ * are checked together: the cache takes the new values only if they were
+ * all accepted, otherwise the accepted ones are written back. Returns
+ * false if nothing could be sent.
+ */
+bool AstrofocusFocuser::applySettings(const SettingsWrite writes[], int count)
+{
+    const char *cmds[SETTINGS_WRITE_MAX];
+    char buffers[SETTINGS_WRITE_MAX][MESSAGE_MAX_LENGHT];
+    SettingsTransaction transaction;
+
+    if (count > SETTINGS_WRITE_MAX)
+        return false;
+
+    for (int i = 0; i < count; i++)
+    {
+        if (!isWritableSetting(writes[i].command, writes[i].value))
+        {
+            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::applySettings => %d is not a valid %s", writes[i].value, commandName(writes[i].command));
+            return false;
+        }
+    }
+
+    // One transaction at a time, the writes that come meanwhile are merged into the next one
+    if (settingsTransaction.count > 0)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            int slot = 0;
+
+            while (slot < queuedSettingsCount && queuedSettings[slot].command != writes[i].command)
+                slot++;
+
+            if (slot == SETTINGS_WRITE_MAX)
+                return false;
+
+            queuedSettings[slot] = writes[i];
+            queuedSettingsCount = std::max(queuedSettingsCount, slot + 1);
+
+            setSettingState(writes[i].command, IPS_BUSY);
+        }
+
+        return true;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        int current = 0;
+
+        const bool known = settingsCache.get(writes[i].command, &current);
+
+        if (known && current == writes[i].value)
+            continue;
+
+        transaction.writes[transaction.count] = writes[i];
+        transaction.previous[transaction.count] = { writes[i].command, current };
+        transaction.hasPrevious[transaction.count] = known && isWritableSetting(writes[i].command, current);
+
+        encodeCommand(buffers[transaction.count], MESSAGE_MAX_LENGHT, writes[i].command, writes[i].value);
+        cmds[transaction.count] = buffers[transaction.count];
+        transaction.count++;
+    }
+
+    // Nothing has changed, the properties only need their state back
+    if (transaction.count == 0)
+    {
+        revertSettings(writes, count, IPS_OK);
+        return true;
+    }
+
+    if (!serialWorker.postGroup(AstrofocusSerialWorker::REQUEST_COMMAND, SERIAL_TAG_SETTINGS_WRITE, cmds, transaction.count))
+        return false;
+
+    transaction.pending = transaction.count;
+    settingsTransaction = transaction;
+
+    for (int i = 0; i < count; i++)
+        setSettingState(writes[i].command, IPS_BUSY);
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::completeSettingsTransaction()
+{
+    SettingsTransaction &transaction = settingsTransaction;
+
+    if (!transaction.rollingBack && !transaction.failed)
+    {
+        for (int i = 0; i < transaction.count; i++)
+            settingsCache.set(transaction.writes[i].command, transaction.writes[i].value);
+
+        // Also brings the motion model up to date
+        revertSettings(transaction.writes, transaction.count, IPS_OK);
+        saveSnapshot();
+
+        // The limit is kept in the configuration too, only once the firmware has it
+        for (int i = 0; i < transaction.count; i++)
+        {
+            if (transaction.writes[i].command == COMMAND_UPPER_LIMIT)
+                saveConfig(true, FocusMaxPosNP.name);
+        }
+
+        transaction.count = 0;
+        applyQueuedSettings();
+        return;
+    }
+
+    if (!transaction.rollingBack)
+    {
+        const char *cmds[SETTINGS_WRITE_MAX];
+        char buffers[SETTINGS_WRITE_MAX][MESSAGE_MAX_LENGHT];
+        int rollback_count = 0;
+
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::completeSettingsTransaction => Settings write failed, rolling back");
+
+        // Which writes have reached the firmware is not known, so all of them are undone
+        for (int i = 0; i < transaction.count; i++)
+        {
+            if (!transaction.hasPrevious[i])
+                continue;
+
+            encodeCommand(buffers[rollback_count], MESSAGE_MAX_LENGHT, transaction.previous[i].command, transaction.previous[i].value);
+            cmds[rollback_count] = buffers[rollback_count];
+            rollback_count++;
+        }
+
+        transaction.rollingBack = true;
+        transaction.failed = (rollback_count < transaction.count);
+
+        if (rollback_count > 0 && serialWorker.postGroup(AstrofocusSerialWorker::REQUEST_COMMAND, SERIAL_TAG_SETTINGS_WRITE, cmds, rollback_count))
+        {
+            transaction.pending = rollback_count;
+            return;
+        }
+
+        transaction.failed = true;
+    }
+
+    // Some value couldn't be restored, or zero can't be written back: what the device has now must be read back
+    if (transaction.failed)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::completeSettingsTransaction => Rollback incomplete, reloading the settings");
+        reloadSettings();
+    }
+
+    revertSettings(transaction.writes, transaction.count, IPS_ALERT);
+    transaction.count = 0;
+    applyQueuedSettings();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::applyQueuedSettings()
+{
+    SettingsWrite writes[SETTINGS_WRITE_MAX];
+    const int count = queuedSettingsCount;
+
+    if (count == 0)
+        return;
+
+    std::copy(queuedSettings, queuedSettings + count, writes);
+    queuedSettingsCount = 0;
+
+    if (!applySettings(writes, count))
+        revertSettings(writes, count, IPS_ALERT);
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Publishes again the cached values of the settings, over whatever the
+ * clients had set in the properties, with the given state.
+ */
+void AstrofocusFocuser::revertSettings(const SettingsWrite writes[], int count, IPState state)
+{
+    for (int i = 0; i < count; i++)
+        settingsCache.markDirty(writes[i].command);
+
+    publishSettings();
+
+    if (state != IPS_OK)
+    {
+        for (int i = 0; i < count; i++)
+            setSettingState(writes[i].command, state);
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::setSettingState(int command, IPState state)
+{
+    switch (command)
+    {
+        case COMMAND_UPPER_LIMIT:
+            FocusMaxPosNP.s = state;
+            IDSetNumber(&FocusMaxPosNP, nullptr);
+            break;
+        case COMMAND_TEMPERATURE_COEFFICIENT:
+            TemperatureCoefficientNP.s = state;
+            IDSetNumber(&TemperatureCoefficientNP, nullptr);
+            break;
+        case COMMAND_STEP_SIZE:
+            StepSizeNP.s = state;
+            IDSetNumber(&StepSizeNP, nullptr);
+            break;
+        case COMMAND_STEPPER_POWER:
+        case COMMAND_PULSES_DURATION:
+        case COMMAND_PAUSE:
+            MotorSettingsNP.s = state;
+            IDSetNumber(&MotorSettingsNP, nullptr);
+            break;
+        case COMMAND_MOTION_MODE:
+            StepperModeSP.s = state;
+            IDSetSwitch(&StepperModeSP, nullptr);
+            break;
+    }
+}
+
+/* ************************************************************************************ */
+
+// N,0 is a query for all of these, and 4,1 takes the current position as the upper limit
+bool AstrofocusFocuser::isWritableSetting(int command, int value)
+{
+    // The ranges come from the command table, 0 would read the setting back instead
+    switch (command)
+    {
+        case COMMAND_UPPER_LIMIT:
+            // 4,1 takes the current position as the limit
+            return value > 1 && isValidCommand(command, value);
+        case COMMAND_TEMPERATURE_COEFFICIENT:
+        case COMMAND_STEP_SIZE:
+        case COMMAND_STEPPER_POWER:
+        case COMMAND_PULSES_DURATION:
+        case COMMAND_PAUSE:
+        case COMMAND_MOTION_MODE:
+            return value != 0 && isValidCommand(command, value);
+        default:
+            return false;
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::configureMotionModel()
+{
+    motionModel.configure(settingsCache.valueOr(COMMAND_PULSES_DURATION, 0), settingsCache.valueOr(COMMAND_MOTION_MODE, 0));
+}
+
+/**************************************************************************************
+ ** Link supervision
+ ***************************************************************************************/
+void AstrofocusFocuser::onReconnectTimer(void *context)
+{
+    static_cast<AstrofocusFocuser *>(context)->reconnect();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::scheduleReconnect()
+{
+    if (reconnectTimerID != -1)
+        return;
+
+    DEBUG(INDI::Logger::DBG_WARNING, "AstrofocusFocuser::scheduleReconnect => Serial link lost, reconnecting");
+
+    // Out of the completion callback, the worker can't be stopped from inside its own dispatch
+    reconnectDelay = 0;
+    reconnectTimerID = IEAddTimer(0, &AstrofocusFocuser::onReconnectTimer, this);
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Reopens the port the connection was made on and resumes from the state
+ * the driver already has, which a couple of queries confirm. On failure
+ * the next attempt comes later and later, up to RECONNECT_MAX_MS.
+ */
+void AstrofocusFocuser::reconnect()
+{
+    int fd = -1;
+
+    reconnectTimerID = -1;
+
+    if (!isConnected())
+        return;
+
+    if (serialWorker.isRunning())
+        dropLink();
+
+    if (tty_connect(serialConnection->port(), serialConnection->baud(), 8, 0, 1, &fd) == TTY_OK)
+    {
+        // The new port takes the number of the old one, which the connection plugin closes on disconnect
+        dup2(fd, PortFD);
+        close(fd);
+
+        if (Handshake())
+        {
+            if (!resumeSettings())
+                loadSettingsFromDevice();
+
+            serialWorker.start(PortFD, &AstrofocusFocuser::onSerialCompletion, this);
+
+            publishSettings();
+            schedulePoll(getCurrentPollingPeriod());
+
+            DEBUG(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::reconnect => Serial link restored");
+            return;
+        }
+
+        dropLink();
+    }
+
+    reconnectDelay = reconnectDelay == 0 ? RECONNECT_MIN_MS : std::min<uint32_t>(reconnectDelay * 2, RECONNECT_MAX_MS);
+    reconnectTimerID = IEAddTimer(reconnectDelay, &AstrofocusFocuser::onReconnectTimer, this);
+
+    DEBUGF(INDI::Logger::DBG_WARNING, "AstrofocusFocuser::reconnect => Unable to reconnect, next attempt in %u s", reconnectDelay / 1000);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::dropLink()
+{
+    if (serialWorker.isRunning())
+        saveSnapshot();
+
+    serialWorker.stop();
+
+    // The dead port is released, so the adapter can come back under the same name, but its number stays taken
+    int null_fd = open("/dev/null", O_RDWR);
+
+    if (null_fd >= 0)
+    {
+        dup2(null_fd, PortFD);
+        close(null_fd);
+    }
+
+    if (pollTimerID != -1)
+    {
+        RemoveTimer(pollTimerID);
+        pollTimerID = -1;
+    }
+
+    positionQueryPending = false;
+    temperatureQueryPending = false;
+    moveCommandPending = false;
+    abortPending = false;
+
+    if (moveInProgress)
+        finishMove(IPS_ALERT);
+
+    // A settings write cut short leaves the device state unknown, the snapshot can't be trusted for it
+    if (settingsTransaction.count > 0)
+    {
+        revertSettings(settingsTransaction.writes, settingsTransaction.count, IPS_ALERT);
+        revertSettings(queuedSettings, queuedSettingsCount, IPS_ALERT);
+        settingsTransaction.count = 0;
+        queuedSettingsCount = 0;
+        snapshot.clear();
+        remove(snapshotPath().c_str());
+    }
+}
+
+/**************************************************************************************
+ ** Move engine
+ ***************************************************************************************/
+bool AstrofocusFocuser::SetFocuserMaxPosition(uint32_t ticks)
+{
+    const SettingsWrite writes[] = { { COMMAND_UPPER_LIMIT, (int)ticks } };
+
+    return applySettings(writes, 1);
+}
+
+/* ************************************************************************************ */
+
+IPState AstrofocusFocuser::MoveAbsFocuser(uint32_t targetTicks)
+{
+    if (targetTicks > FocusAbsPosN[0].max)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::MoveAbsFocuser => Target %u is over the upper limit %.0f", targetTicks, FocusAbsPosN[0].max);
+        return IPS_ALERT;
+    }
+
+    return requestMove(targetTicks);
+}
+
+/* ************************************************************************************ */
+
+IPState AstrofocusFocuser::MoveRelFocuser(FocusDirection dir, uint32_t ticks)
+{
+    int steps = ticks;
+
+    // A burst of relative moves adds up: each one starts from where the previous is going
+    const int origin = requestedTarget();
+
+    if (dir == FOCUS_INWARD)
+        steps = -std::min<int>(steps, origin - FocusAbsPosN[0].min);
+    else
+        steps = std::min<int>(steps, FocusAbsPosN[0].max - origin);
+
+    if (steps == 0 && !moveInProgress)
+        return IPS_OK;
+
+    DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::MoveRelFocuser => Moving by %d steps to %d", steps, origin + steps);
+
+    return requestMove(origin + steps);
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Front of the move path. Only one move command is on the serial link at
+ * any time: the requests that arrive meanwhile are merged into a single
+ * queued target, newer targets replacing older ones, and that target is
+ * sent when the command in flight is acknowledged. A running move is not
+ * waited for, the new target simply replaces the old one on the motor.
+ */
+IPState AstrofocusFocuser::requestMove(int target)
+{
+    if (moveCommandPending || abortPending)
+    {
+        if (queuedTarget >= 0)
+            DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::requestMove => Target %d replaces %d", target, queuedTarget);
+
+        queuedTarget = target;
+        return IPS_BUSY;
+    }
+
+    return sendMove(target) ? IPS_BUSY : IPS_ALERT;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusFocuser::sendMove(int target)
+{
+    char cmd[MESSAGE_MAX_LENGHT];
+
+    const int first_leg = backlashApproach(target);
+
+    if (encodeCommand(cmd, MESSAGE_MAX_LENGHT, COMMAND_GOTO, first_leg) == 0 ||
+            !serialWorker.post(AstrofocusSerialWorker::REQUEST_COMMAND, SERIAL_TAG_MOVE, cmd))
+        return false;
+
+    // Against the final direction the motor goes past the target first, the last leg takes the slack up
+    approachTarget = (first_leg != target) ? target : -1;
+    targetPosition = first_leg;
+    queuedTarget = -1;
+    moveCommandPending = true;
+
+    DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::sendMove => Moving from %d to %d", lastPosition, targetPosition);
+
+    if (!moveInProgress)
+    {
+        startMove();
+        return true;
+    }
+
+    // Re-targeted on the way, the running leg starts again from here
+    moveStartPosition = lastPosition;
+    moveStartTime = lastProgressTime = std::chrono::steady_clock::now();
+    publishMoveEta(lastPosition);
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Where the focuser will be once the requested moves are done.
+ */
+int AstrofocusFocuser::requestedTarget() const
+{
+    if (queuedTarget >= 0)
+        return queuedTarget;
+
+    if (!moveInProgress)
+        return lastPosition;
+
+    return approachTarget >= 0 ? approachTarget : targetPosition;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusFocuser::AbortFocuser()
+{
+    if (autofocus.active() || autofocusFinalMove)
+        stopAutofocus(IPS_IDLE, "Autofocus aborted");
+
+    if (calibrationStep >= 0)
+        stopBacklashCalibration(IPS_IDLE, "Backlash calibration aborted");
+
+    approachTarget = -1;
+    queuedTarget = -1;
+
+    // The current position is needed first, the stop itself is sent when it comes back
+    if (!serialWorker.post(AstrofocusSerialWorker::REQUEST_QUERY, SERIAL_TAG_ABORT_POSITION, commandText<COMMAND_POSITION, 0>()))
+        return false;
+
+    abortPending = true;
+    return true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::TimerHit()
+{
+    pollTimerID = -1;
+
+    if (!isConnected())
+        return;
+
+    // The temperature rides in the same batch as the position query
+    if (hasTemperatureSensor && !temperatureQueryPending &&
+            std::chrono::steady_clock::now() - lastTemperaturePoll >= std::chrono::milliseconds(TEMPERATURE_POLL_MS))
+    {
+        if (serialWorker.post(AstrofocusSerialWorker::REQUEST_QUERY, SERIAL_TAG_TEMPERATURE, commandText<COMMAND_TEMPERATURE, 1>()))
+        {
+            temperatureQueryPending = true;
+            lastTemperaturePoll = std::chrono::steady_clock::now();
+        }
+    }
+
+    // A camera that never reports the end of its exposure doesn't hold the corrections forever
+    if (correctionHeld && std::chrono::steady_clock::now() - correctionHeldSince >= std::chrono::seconds((int)ExposureHoldN[0].value))
+    {
+        DEBUG(INDI::Logger::DBG_WARNING, "AstrofocusFocuser::TimerHit => No readout within the max hold, moving during the exposure");
+        releaseCorrection();
+    }
+
+    flushPublications();
+
+    if (std::chrono::steady_clock::now() - lastDiagnosticsPublish >= std::chrono::milliseconds(DIAGNOSTICS_PUBLISH_MS))
+        publishDiagnostics(false);
+
+    if (TelemetryStreamS[TELEMETRY_STREAM_ON].s == ISS_ON &&
+            std::chrono::steady_clock::now() - lastTelemetryExport >= std::chrono::milliseconds(TELEMETRY_STREAM_MS))
+        exportTelemetry();
+
+    // Only one position query in flight at any time, the next poll is scheduled when it completes
+    if (positionQueryPending)
+        return;
+
+    if (serialWorker.post(AstrofocusSerialWorker::REQUEST_QUERY, SERIAL_TAG_POSITION, commandText<COMMAND_POSITION, 0>()))
+    {
+        positionQueryPending = true;
+        positionQueryTime = std::chrono::steady_clock::now();
+    }
+    else
+        schedulePoll(nextPollInterval(lastPosition));
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::processPosition(int position, bool valid)
+{
+    if (!valid)
+    {
+        schedulePoll(nextPollInterval(lastPosition));
+        return;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+
+    if (position != lastPosition)
+    {
+        // A position short of the target is a point of the move curve, one at the target only bounds it
+        if (moveInProgress && position != targetPosition)
+            motionModel.learn(position - moveStartPosition,
+                              std::chrono::duration<double, std::milli>(now - moveStartTime).count());
+
+        lastProgressTime = now;
+
+        FocusAbsPosN[0].value = position;
+        publishNumber(&FocusAbsPosNP, positionPublisher);
+    }
+
+    settingsCache.set(COMMAND_POSITION, position);
+    settingsCache.clearDirty(COMMAND_POSITION);
+
+    lastPosition = position;
+
+    if (moveInProgress)
+    {
+        // Until the last command is acknowledged the motor may still be heading to an older target
+        if (moveCommandPending)
+            lastProgressTime = now;
+        else if (position == targetPosition && approachTarget >= 0)
+        {
+            char cmd[MESSAGE_MAX_LENGHT];
+
+            if (encodeCommand(cmd, MESSAGE_MAX_LENGHT, COMMAND_GOTO, approachTarget) > 0 &&
+                    serialWorker.post(AstrofocusSerialWorker::REQUEST_COMMAND, SERIAL_TAG_MOVE, cmd))
+            {
+                DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::processPosition => Overshoot reached, final approach to %d", approachTarget);
+
+                moveCommandPending = true;
+
+                targetPosition = approachTarget;
+                moveStartPosition = position;
+                moveStartTime = lastProgressTime = now;
+            }
+            else
+                finishMove(IPS_ALERT);
+
+            approachTarget = -1;
+        }
+        else if (position == targetPosition)
+        {
+            finishMove(IPS_OK);
+            DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::processPosition => Focuser reached position %d", position);
+        }
+        else if (std::chrono::duration_cast<std::chrono::milliseconds>(now - lastProgressTime).count() > STALL_TIMEOUT_MS)
+        {
+            finishMove(IPS_ALERT);
+            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::processPosition => Focuser stuck at %d, target was %d", position, targetPosition);
+        }
+    }
+
+    if (moveInProgress)
+        publishMoveEta(position);
+
+    publishSharedStatus();
+
+    schedulePoll(nextPollInterval(position));
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::startMove()
+{
+    moveInProgress = true;
+    moveStartPosition = lastPosition;
+    moveStartTime = lastProgressTime = std::chrono::steady_clock::now();
+
+    publishMoveEta(lastPosition);
+
+    if (!positionQueryPending)
+        schedulePoll(nextPollInterval(lastPosition));
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::schedulePoll(uint32_t ms)
+{
+    if (pollTimerID != -1)
+        RemoveTimer(pollTimerID);
+
+    pollTimerID = SetTimer(ms);
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Idle focusers are polled at the device polling period. While moving, the
+ * driver sleeps until just before the predicted arrival: the lead is a
+ * fraction of the remaining time, so a wrong prediction is caught by the
+ * next, closer, poll. Long moves are still polled every POLL_MOVE_MAX_MS.
+ */
+uint32_t AstrofocusFocuser::nextPollInterval(int position)
+{
+    if (!moveInProgress)
+        return getCurrentPollingPeriod();
+
+    const double remaining_ms = remainingMoveMs(position);
+    const double lead_ms = std::max<double>(POLL_MIN_MS, remaining_ms * POLL_LEAD_FRACTION);
+
+    return std::max<double>(POLL_MIN_MS, std::min<double>(POLL_MOVE_MAX_MS, remaining_ms - lead_ms));
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Time left to the target of the running leg, by the motion model. Before
+ * the motor has moved the whole prediction is counted from the start of the
+ * leg, afterwards only the steps that are left.
+ */
+double AstrofocusFocuser::remainingMoveMs(int position) const
+{
+    double remaining_ms;
+
+    if (position == moveStartPosition)
+    {
+        const double elapsed_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - moveStartTime).count();
+
+        remaining_ms = std::max(0., motionModel.predictMs(targetPosition - moveStartPosition) - elapsed_ms);
+    }
+    else
+        remaining_ms = std::abs(targetPosition - position) * motionModel.msPerStep();
+
+    // The final leg of an overshoot move is still to come
+    if (approachTarget >= 0)
+        remaining_ms += motionModel.predictMs(approachTarget - targetPosition);
+
+    return remaining_ms;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::publishMoveEta(int position)
+{
+    MoveEtaN[MOVE_ETA_REMAINING].value = moveInProgress ? remainingMoveMs(position) / 1000. : 0.;
+    MoveEtaN[MOVE_ETA_STEP_TIME].value = motionModel.msPerStep();
+    MoveEtaNP.s = moveInProgress ? IPS_BUSY : IPS_IDLE;
+    publishNumber(&MoveEtaNP, etaPublisher);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::finishMove(IPState state)
+{
+    moveInProgress = false;
+    approachTarget = -1;
+    queuedTarget = -1;
+    targetPosition = lastPosition;
+
+    publishMoveEta(lastPosition);
+
+    FocusAbsPosN[0].value = lastPosition;
+    FocusAbsPosNP.s = state;
+    publishNumber(&FocusAbsPosNP, positionPublisher, true);
+
+    if (FocusRelPosNP.s == IPS_BUSY)
+    {
+        FocusRelPosNP.s = state;
+        IDSetNumber(&FocusRelPosNP, nullptr);
+    }
+
+    if (autofocusFinalMove)
+    {
+        stopAutofocus(state, state == IPS_OK ? "Autofocus complete" : "Autofocus failed to reach the best position");
+        return;
+    }
+
+    if (calibrationStep >= 0)
+    {
+        if (state != IPS_OK)
+            stopBacklashCalibration(IPS_ALERT, "Backlash calibration move failed");
+        else if (calibrationStep == 0)
+        {
+            // The approach move only takes the slack up, nothing to measure there
+            calibrationStep++;
+            advanceBacklashCalibration();
+        }
+        else
+        {
+            autofocusWaitingExposure = true;
+            autofocusExposureStarted = false;
+        }
+
+        return;
+    }
+
+    if (!autofocus.active())
+        return;
+
+    if (state != IPS_OK)
+    {
+        stopAutofocus(IPS_ALERT, "Autofocus move failed");
+        return;
+    }
+
+    // Only an exposure that starts from now on is sharp at this position
+    autofocusWaitingExposure = true;
+    autofocusExposureStarted = false;
+}
+
+/**************************************************************************************
+ ** Client updates
+ ***************************************************************************************/
+void AstrofocusFocuser::applyPublishLimits()
+{
+    const uint32_t min_interval_ms = PublishLimitsN[PUBLISH_MIN_INTERVAL].value;
+    const uint32_t max_interval_ms = PublishLimitsN[PUBLISH_MAX_INTERVAL].value;
+
+    positionPublisher.setLimits(PublishLimitsN[PUBLISH_POSITION_DEADBAND].value, min_interval_ms, max_interval_ms);
+    temperaturePublisher.setLimits(PublishLimitsN[PUBLISH_TEMPERATURE_DEADBAND].value, min_interval_ms, max_interval_ms);
+    etaPublisher.setLimits(0, min_interval_ms, max_interval_ms);
+
+    positionPublisher.reset();
+    temperaturePublisher.reset();
+    etaPublisher.reset();
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Polled values go through their publisher, so a slow client link only
+ * carries the updates that matter. Forced updates are the ones a client
+ * must not miss: a new state, the end of a move, a value set on purpose.
+ */
+void AstrofocusFocuser::publishNumber(INumberVectorProperty *property, AstrofocusPublisher &publisher, bool force)
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    if (!force && !publisher.update(*property, now))
+        return;
+
+    IDSetNumber(property, nullptr);
+    publisher.sent(*property, now);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::flushPublications()
+{
+    const auto now = std::chrono::steady_clock::now();
+
+    if (positionPublisher.due(now))
+        publishNumber(&FocusAbsPosNP, positionPublisher, true);
+
+    if (hasTemperatureSensor && temperaturePublisher.due(now))
+        publishNumber(&TemperatureNP, temperaturePublisher, true);
+
+    if (etaPublisher.due(now))
+        publishNumber(&MoveEtaNP, etaPublisher, true);
+}
+
+/**************************************************************************************
+ ** Diagnostics
+ ***************************************************************************************/
+void AstrofocusFocuser::publishDiagnostics(bool force)
+{
+    const AstrofocusDiagnostics &diagnostics = serialWorker.getDiagnostics();
+
+    lastDiagnosticsPublish = std::chrono::steady_clock::now();
+
+    if (!force && diagnostics.generation() == publishedDiagnostics)
+        return;
+
+    publishedDiagnostics = diagnostics.generation();
+
+    const AstrofocusDiagnostics::LinkStats link = diagnostics.link();
+
+    LinkDiagnosticsN[LINK_BATCHES].value = link.batches;
+    LinkDiagnosticsN[LINK_BYTES_OUT].value = link.bytesOut;
+    LinkDiagnosticsN[LINK_BYTES_IN].value = link.bytesIn;
+    LinkDiagnosticsN[LINK_TIMEOUTS].value = link.timeouts;
+    LinkDiagnosticsN[LINK_RESYNCS].value = link.resyncs;
+    LinkDiagnosticsN[LINK_STALE_REPLIES].value = link.staleReplies;
+    LinkDiagnosticsN[LINK_DROPPED_LINES].value = link.droppedLines;
+    LinkDiagnosticsN[LINK_COALESCED].value = link.coalesced;
+    LinkDiagnosticsNP.s = (link.timeouts > 0) ? IPS_ALERT : IPS_OK;
+    IDSetNumber(&LinkDiagnosticsNP, nullptr);
+
+    for (int code = 0; code < COMMAND_COUNT; code++)
+    {
+        const AstrofocusDiagnostics::CommandStats stats = diagnostics.command(code);
+
+        CommandStatsN[COMMAND_STATS_COUNT][code].value = stats.count;
+        CommandStatsN[COMMAND_STATS_ERRORS][code].value = stats.errors;
+        CommandStatsN[COMMAND_STATS_P50][code].value = stats.p50Ms;
+        CommandStatsN[COMMAND_STATS_P99][code].value = stats.p99Ms;
+        CommandStatsN[COMMAND_STATS_MAX][code].value = stats.maxMs;
+    }
+
+    for (int i = 0; i < COMMAND_STATS_PROPERTIES; i++)
+    {
+        CommandStatsNP[i].s = IPS_OK;
+        IDSetNumber(&CommandStatsNP[i], nullptr);
+    }
+}
+
+/**************************************************************************************
+ ** Telemetry
+ ***************************************************************************************/
+void AstrofocusFocuser::recordTelemetry(int latency_ms)
+{
+    const auto now = std::chrono::steady_clock::now();
+    AstrofocusTelemetry::Sample sample;
+
+    sample.timeMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    sample.position = lastPosition;
+    sample.target = moveInProgress ? requestedTarget() : lastPosition;
+    sample.temperature = hasTemperatureSensor ? TemperatureN[0].value : NAN;
+    sample.latencyMs = std::min(latency_ms, (int)UINT16_MAX);
+    sample.state = moveInProgress ? IPS_BUSY : FocusAbsPosNP.s;
+
+    // A focuser standing still only needs a sample now and then, or when something changes
+    const bool unchanged = sample.position == lastTelemetry.position && sample.state == lastTelemetry.state &&
+                           (!hasTemperatureSensor || sample.temperature == lastTelemetry.temperature);
+
+    if (!moveInProgress && unchanged && now - lastTelemetrySample < std::chrono::milliseconds(TELEMETRY_IDLE_MS))
+        return;
+
+    telemetry.add(sample);
+
+    lastTelemetry = sample;
+    lastTelemetrySample = now;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Sends the samples recorded since the previous export. One export is
+ * bounded to TELEMETRY_EXPORT_MAX samples, so it never holds the event
+ * loop for long: a backlog goes out over the next exports.
+ */
+bool AstrofocusFocuser::exportTelemetry()
+{
+    size_t size = 0;
+    uint64_t lost = 0;
+
+    const char *csv = telemetry.exportCsv(&size, &lost);
+
+    lastTelemetryExport = std::chrono::steady_clock::now();
+
+    if (lost > 0)
+        DEBUGF(INDI::Logger::DBG_WARNING, "AstrofocusFocuser::exportTelemetry => %llu samples overwritten before their export",
+               (unsigned long long)lost);
+
+    if (csv == nullptr)
+        return false;
+
+    TelemetryB[0].blob = const_cast<char *>(csv);
+    TelemetryB[0].bloblen = TelemetryB[0].size = size;
+    TelemetryBP.s = IPS_OK;
+    IDSetBLOB(&TelemetryBP, nullptr);
+
+    return true;
+}
+
+/**************************************************************************************
+ ** Autofocus
+ ***************************************************************************************/
+bool AstrofocusFocuser::startAutofocus()
+{
+    const char *camera = AutofocusCameraT[AUTOFOCUS_CAMERA_DEVICE].text;
+
+    if (moveInProgress)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::startAutofocus => The focuser is moving");
+        return false;
+    }
+
+    if (!autofocus.start(lastPosition, AutofocusSettingsN[AUTOFOCUS_COARSE_STEP].value, AutofocusSettingsN[AUTOFOCUS_COARSE_POINTS].value,
+                         AutofocusSettingsN[AUTOFOCUS_FINE_STEP].value, AutofocusSettingsN[AUTOFOCUS_FINE_POINTS].value,
+                         FocusAbsPosN[0].min, FocusAbsPosN[0].max))
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::startAutofocus => Invalid sweep settings");
+        return false;
+    }
+
+    IDSnoopDevice(camera, "CCD_EXPOSURE");
+    IDSnoopDevice(camera, AutofocusCameraT[AUTOFOCUS_CAMERA_PROPERTY].text);
+
+    autofocusWaitingExposure = false;
+    autofocusFinalMove = false;
+    autofocusPendingCount = 0;
+
+    AutofocusSP.s = IPS_BUSY;
+    IDSetSwitch(&AutofocusSP, nullptr);
+
+    DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::startAutofocus => Sweeping around %d, waiting for the exposures of %s",
+           lastPosition, camera);
+
+    advanceAutofocus();
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::stopAutofocus(IPState state, const char *message)
+{
+    autofocus.abort();
+    autofocusWaitingExposure = false;
+    autofocusFinalMove = false;
+    autofocusPendingCount = 0;
+
+    AutofocusSP.s = state;
+    IDSetSwitch(&AutofocusSP, "%s", message);
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Moves to the next point of the sweep. It's called as soon as an exposure
+ * ends, so the focuser travels while the camera downloads the frame and
+ * the client measures it.
+ */
+void AstrofocusFocuser::advanceAutofocus()
+{
+    int target = 0;
+
+    if (autofocus.phase() == AstrofocusAutofocus::PHASE_FAILED)
+    {
+        stopAutofocus(IPS_ALERT, "Autofocus failed, no usable HFR");
+        return;
+    }
+
+    if (autofocus.phase() == AstrofocusAutofocus::PHASE_DONE)
+    {
+        target = autofocus.bestPosition();
+
+        AutofocusResultN[AUTOFOCUS_RESULT_POSITION].value = target;
+        AutofocusResultN[AUTOFOCUS_RESULT_HFR].value = autofocus.bestHfr();
+        AutofocusResultNP.s = IPS_OK;
+        IDSetNumber(&AutofocusResultNP, nullptr);
+
+        autofocus.abort();
+        autofocusFinalMove = true;
+    }
+    else if (!autofocus.nextTarget(&target))
+        return;     // The sweep is complete, its last samples are still being measured
+
+    if (target == lastPosition)
+    {
+        // Already there, but finishMove() still has to run to go on
+        startMove();
+        finishMove(IPS_OK);
+        return;
+    }
+
+    if (MoveAbsFocuser(target) != IPS_BUSY)
+    {
+        stopAutofocus(IPS_ALERT, "Autofocus move rejected");
+        return;
+    }
+
+    FocusAbsPosN[0].value = lastPosition;
+    FocusAbsPosNP.s = IPS_BUSY;
+    publishNumber(&FocusAbsPosNP, positionPublisher, true);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::onExposureState(IPState state)
+{
+    if (!autofocusWaitingExposure)
+        return;
+
+    if (state == IPS_BUSY)
+    {
+        autofocusExposureStarted = true;
+        return;
+    }
+
+    if (state == IPS_ALERT)
+    {
+        failMeasurement("the exposure failed");
+        return;
+    }
+
+    if (state != IPS_OK || !autofocusExposureStarted)
+        return;
+
+    if (autofocusPendingCount == AUTOFOCUS_PIPELINE)
+    {
+        failMeasurement("no HFR received for the last exposures");
+        return;
+    }
+
+    // The frame is taken: its HFR will follow, the focuser can leave now
+    autofocusWaitingExposure = false;
+
+    if (calibrationStep >= 0)
+    {
+        autofocusPending[autofocusPendingCount++] = calibrationStep++;
+        advanceBacklashCalibration();
+        return;
+    }
+
+    autofocusPending[autofocusPendingCount++] = lastPosition;
+    advanceAutofocus();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::onHfrMeasured(double hfr)
+{
+    if (autofocusPendingCount == 0)
+        return;
+
+    const int position = autofocusPending[0];
+
+    std::copy(autofocusPending + 1, autofocusPending + autofocusPendingCount, autofocusPending);
+    autofocusPendingCount--;
+
+    if (hfr <= 0)
+    {
+        failMeasurement("the camera reported no HFR");
+        return;
+    }
+
+    if (calibrationStep >= 0)
+    {
+        // Calibration samples are filed by step, the first step is the approach
+        calibrationSamples[position - 1] = hfr;
+
+        if (++calibrationReceived == BACKLASH_CALIBRATION_SAMPLES)
+            completeBacklashCalibration();
+
+        return;
+    }
+
+    DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::onHfrMeasured => HFR %.2f at %d", hfr, position);
+
+    autofocus.addSample(position, hfr);
+
+    // A completed sweep plans the next one, its first move could not start before
+    if (!moveInProgress && !autofocusWaitingExposure && autofocusPendingCount == 0)
+        advanceAutofocus();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::failMeasurement(const char *message)
+{
+    char text[MAXRBUF];
+
+    if (calibrationStep >= 0)
+    {
+        snprintf(text, MAXRBUF, "Backlash calibration stopped, %s", message);
+        stopBacklashCalibration(IPS_ALERT, text);
+    }
+    else
+    {
+        snprintf(text, MAXRBUF, "Autofocus stopped, %s", message);
+        stopAutofocus(IPS_ALERT, text);
+    }
+}
+
+/**************************************************************************************
+ ** Backlash
+ ***************************************************************************************/
+
+/**
+ * First leg of a move to target. Moves in the final direction go straight
+ * there, the others overshoot by the backlash of the final direction plus
+ * a margin, so every move ends with the slack taken up the same way.
+ */
+uint32_t AstrofocusFocuser::backlashApproach(uint32_t target) const
+{
+    const int mode = IUFindOnSwitchIndex(&BacklashModeSP);
+
+    // The calibration measures the raw mechanics
+    if (mode <= BACKLASH_OFF || calibrationStep >= 0 || (int)target == lastPosition)
+        return target;
+
+    const bool outward = ((int)target > lastPosition);
+
+    if (mode == BACKLASH_FINAL_OUTWARD && !outward)
+    {
+        const double overshoot = BacklashSettingsN[BACKLASH_OUTWARD].value + BacklashSettingsN[BACKLASH_MARGIN].value;
+
+        return std::max<double>(FocusAbsPosN[0].min, target - overshoot);
+    }
+
+    if (mode == BACKLASH_FINAL_INWARD && outward)
+    {
+        const double overshoot = BacklashSettingsN[BACKLASH_INWARD].value + BacklashSettingsN[BACKLASH_MARGIN].value;
+
+        return std::min<double>(FocusAbsPosN[0].max, target + overshoot);
+    }
+
+    return target;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * The focuser must sit on the flank of the V-curve, where the HFR changes
+ * linearly with the position. One cycle goes out and back by the
+ * calibration step: the step counter is the same at both ends, the HFR
+ * tells how much the optics really moved, so the lost motion of each
+ * direction can be measured.
+ */
+bool AstrofocusFocuser::startBacklashCalibration()
+{
+    const int step = BacklashSettingsN[BACKLASH_CALIBRATION_STEP].value;
+
+    if (moveInProgress || autofocus.active() || autofocusFinalMove)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::startBacklashCalibration => The focuser is busy");
+        return false;
+    }
+
+    if (lastPosition - step < FocusAbsPosN[0].min || lastPosition + step > FocusAbsPosN[0].max)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::startBacklashCalibration => Too close to a limit");
+        return false;
+    }
+
+    IDSnoopDevice(AutofocusCameraT[AUTOFOCUS_CAMERA_DEVICE].text, "CCD_EXPOSURE");
+    IDSnoopDevice(AutofocusCameraT[AUTOFOCUS_CAMERA_DEVICE].text, AutofocusCameraT[AUTOFOCUS_CAMERA_PROPERTY].text);
+
+    calibrationOrigin = lastPosition;
+    calibrationStep = 0;
+    calibrationReceived = 0;
+    autofocusWaitingExposure = false;
+    autofocusPendingCount = 0;
+
+    BacklashCalibrateSP.s = IPS_BUSY;
+    IDSetSwitch(&BacklashCalibrateSP, nullptr);
+
+    advanceBacklashCalibration();
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::stopBacklashCalibration(IPState state, const char *message)
+{
+    calibrationStep = -1;
+    autofocusWaitingExposure = false;
+    autofocusPendingCount = 0;
+
+    BacklashCalibrateSP.s = state;
+    IDSetSwitch(&BacklashCalibrateSP, "%s", message);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::advanceBacklashCalibration()
+{
+    const int step = BacklashSettingsN[BACKLASH_CALIBRATION_STEP].value;
+
+    // Approach outwards, then origin, out, back in, out again: one sample after every move but the first
+    const int targets[BACKLASH_CALIBRATION_SAMPLES + 1] =
+    {
+        calibrationOrigin - step, calibrationOrigin, calibrationOrigin + step, calibrationOrigin, calibrationOrigin + step
+    };
+
+    if (calibrationStep > BACKLASH_CALIBRATION_SAMPLES)
+        return;     // Waiting for the last HFR
+
+    if (MoveAbsFocuser(targets[calibrationStep]) != IPS_BUSY)
+    {
+        stopBacklashCalibration(IPS_ALERT, "Backlash calibration move rejected");
+        return;
+    }
+
+    FocusAbsPosNP.s = IPS_BUSY;
+    publishNumber(&FocusAbsPosNP, positionPublisher, true);
+}
+
+/* ************************************************************************************ */
+
+/**
+ * With h0 at the origin and h1 one step out, the slope is (h1 - h0) / step.
+ * Coming back in, the optics stop short by the inward backlash: h2 is seen
+ * at origin + inward. Going out again, the outward backlash is lost: h3 is
+ * seen at origin + inward + step - outward.
+ */
+void AstrofocusFocuser::completeBacklashCalibration()
+{
+    const double step = BacklashSettingsN[BACKLASH_CALIBRATION_STEP].value;
+    const double *h = calibrationSamples;
+    const double slope = (h[1] - h[0]) / step;
+
+    if (std::fabs(h[1] - h[0]) < 0.05 * h[0])
+    {
+        stopBacklashCalibration(IPS_ALERT, "Backlash calibration failed, the HFR doesn't change: move to the flank of the V-curve");
+        return;
+    }
+
+    const double inward = (h[2] - h[0]) / slope;
+    const double outward = inward + step - (h[3] - h[0]) / slope;
+
+    BacklashSettingsN[BACKLASH_INWARD].value = std::lround(std::max(0., std::min(step, inward)));
+    BacklashSettingsN[BACKLASH_OUTWARD].value = std::lround(std::max(0., std::min(step, outward)));
+    BacklashSettingsNP.s = IPS_OK;
+    IDSetNumber(&BacklashSettingsNP, nullptr);
+
+    saveConfig(true, BacklashSettingsNP.name);
+
+    char message[MAXRBUF];
+
+    snprintf(message, MAXRBUF, "Backlash calibrated: %.0f steps inward, %.0f steps outward",
+             BacklashSettingsN[BACKLASH_INWARD].value, BacklashSettingsN[BACKLASH_OUTWARD].value);
+
+    stopBacklashCalibration(IPS_OK, message);
+}
+
+/**************************************************************************************
+ ** Temperature
+ ***************************************************************************************/
+void AstrofocusFocuser::processTemperature(float temperature, bool valid)
+{
+    if (!valid)
+    {
+        if (TemperatureNP.s != IPS_ALERT)
+        {
+            TemperatureNP.s = IPS_ALERT;
+            publishNumber(&TemperatureNP, temperaturePublisher, true);
+            publishSharedStatus();
+        }
+
+        return;
+    }
+
+    temperatureFilter.add(temperature, monotonicSeconds());
+
+    TemperatureN[0].value = temperatureFilter.value();
+    TemperatureNP.s = IPS_OK;
+    publishNumber(&TemperatureNP, temperaturePublisher);
+    publishSharedStatus();
+
+    applyTemperatureCompensation();
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Host-side compensation. The correction is computed on the temperature
+ * expected after the lead time, so every move anticipates the drift and
+ * the motor moves seldom, by at least the configured minimum.
+ */
+void AstrofocusFocuser::applyTemperatureCompensation()
+{
+    if (IUFindOnSwitchIndex(&TemperatureCompensationSP) != TEMPERATURE_COMPENSATION_DRIVER)
+        return;
+
+    // Sweeps and calibrations own the focuser, the drift is taken care of by the next focus run
+    if (moveInProgress || !temperatureFilter.ready() || autofocus.active() || autofocusFinalMove || calibrationStep >= 0)
+        return;
+
+    double predicted;
+    const int delta = compensationDelta(predicted);
+
+    if (std::abs(delta) < CompensationSettingsN[COMPENSATION_MIN_MOVE].value)
+        return;
+
+    // The drift keeps adding up, it is worked out again when the frame is read out
+    if (holdCorrection())
+    {
+        publishHeldCorrection();
+        return;
+    }
+
+    const int target = std::max<int>(FocusAbsPosN[0].min, std::min<int>(FocusAbsPosN[0].max, lastPosition + delta));
+
+    if (target == lastPosition)
+        return;
+
+    DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::applyTemperatureCompensation => %.2f C predicted, moving by %d steps",
+           predicted, target - lastPosition);
+
+    if (MoveAbsFocuser(target) == IPS_BUSY)
+    {
+        appliedCompensation += target - lastPosition;
+
+        FocusAbsPosNP.s = IPS_BUSY;
+        publishNumber(&FocusAbsPosNP, positionPublisher, true);
+    }
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Steps still to move for the temperature expected after the lead time.
+ */
+int AstrofocusFocuser::compensationDelta(double &predicted) const
+{
+    predicted = temperatureFilter.value() + temperatureFilter.slope() * CompensationSettingsN[COMPENSATION_LEAD_TIME].value;
+
+    return std::lround(CompensationSettingsN[COMPENSATION_STEPS_PER_DEGREE].value * (predicted - referenceTemperature)) - appliedCompensation;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::resetTemperatureCompensation()
+{
+    referenceTemperature = temperatureFilter.value();
+    appliedCompensation = 0;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Switches to another optical train. Only the settings that differ from the
+ * device are written, in one transaction, and the focus offset between the
+ * two trains is posted right behind them so that everything goes out in the
+ * same batch. The firmware runs the commands in order: the move already
+ * goes with the new motor settings.
+ */
+bool AstrofocusFocuser::applyOpticalTrain(int index, int previous)
+{
+    static const int commands[TRAIN_FOCUS_OFFSET] =
+    {
+        COMMAND_STEP_SIZE,
+        COMMAND_MOTION_MODE,
+        COMMAND_STEPPER_POWER,
+        COMMAND_PULSES_DURATION,
+        COMMAND_PAUSE
+    };
+
+    const INumber *train = TrainSettingsN[index];
+    SettingsWrite writes[TRAIN_FOCUS_OFFSET];
+    int count = 0;
+
+    if (autofocus.active() || autofocusFinalMove || calibrationStep >= 0)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::applyOpticalTrain => The focuser is busy with a focus run");
+        return false;
+    }
+
+    for (int i = 0; i < TRAIN_FOCUS_OFFSET; i++)
+    {
+        if ((int)train[i].value != 0)
+            writes[count++] = { commands[i], (int)train[i].value };
+    }
+
+    serialWorker.holdBatch();
+
+    if (count > 0 && !applySettings(writes, count))
+    {
+        serialWorker.releaseBatch();
+
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::applyOpticalTrain => Unable to apply %s", TrainNamesT[index].text);
+        return false;
+    }
+
+    DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::applyOpticalTrain => %s applied", TrainNamesT[index].text);
+
+    // Without a train to start from there is no offset to move by
+    if (previous >= 0 && previous != index && TrainOffsetMoveS[TRAIN_OFFSET_MOVE_ON].s == ISS_ON)
+    {
+        const int origin = requestedTarget();
+        const int offset = train[TRAIN_FOCUS_OFFSET].value - TrainSettingsN[previous][TRAIN_FOCUS_OFFSET].value;
+        const int target = std::max<int>(FocusAbsPosN[0].min, std::min<int>(FocusAbsPosN[0].max, origin + offset));
+
+        if (target != origin)
+        {
+            DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::applyOpticalTrain => Moving by %d steps from %s", target - origin,
+                   TrainNamesT[previous].text);
+
+            // The settings are on their way whatever happens to the move, the train has changed anyway
+            FocusAbsPosNP.s = requestMove(target);
+            publishNumber(&FocusAbsPosNP, positionPublisher, true);
+        }
+    }
+
+    serialWorker.releaseBatch();
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::updateOpticalTrainLabels()
+{
+    bool changed = false;
+
+    for (int i = 0; i < OPTICAL_TRAINS; i++)
+    {
+        char label[MAXINDILABEL];
+
+        // An empty name gives the slot its number back
+        if (TrainNamesT[i].text[0] != '\0')
+            snprintf(label, MAXINDILABEL, "%s", TrainNamesT[i].text);
+        else
+            snprintf(label, MAXINDILABEL, "Train %d", i + 1);
+
+        if (!strcmp(label, TrainS[i].label))
+            continue;
+
+        snprintf(TrainS[i].label, MAXINDILABEL, "%s", label);
+        snprintf(TrainSettingsNP[i].label, MAXINDILABEL, "%s", label);
+        changed = true;
+    }
+
+    if (!changed || !isConnected())
+        return;
+
+    // Clients only read labels when a property is defined
+    deleteProperty(TrainSP.name);
+    defineProperty(&TrainSP);
+
+    for (int i = 0; i < OPTICAL_TRAINS; i++)
+    {
+        deleteProperty(TrainSettingsNP[i].name);
+        defineProperty(&TrainSettingsNP[i]);
+    }
+}
+
+/**************************************************************************************
+ ** Filter offsets
+ ***************************************************************************************/
+void AstrofocusFocuser::snoopFilterWheel()
+{
+    // Another wheel, or the same one after a reconnect: its first report says where it stands
+    focusedSlot = -1;
+
+    if (FilterWheelT[0].text[0] == '\0')
+        return;
+
+    IDSnoopDevice(FilterWheelT[0].text, "FILTER_SLOT");
+    IDSnoopDevice(FilterWheelT[0].text, "FILTER_NAME");
+}
+
+/* ************************************************************************************ */
+
+int AstrofocusFocuser::filterOffset(int slot) const
+{
+    return (slot >= 1 && slot <= FILTER_SLOTS) ? (int)FilterOffsetN[slot - 1].value : 0;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Filter changes seen on the wheel. A wheel that publishes its target slot
+ * together with the busy state gets the focus offset moving at once, in
+ * parallel with the rotation. The others still report the old slot while
+ * busy: for them the move starts as soon as the new slot is reported.
+ */
+void AstrofocusFocuser::onFilterSlot(int slot, IPState state)
+{
+    if (slot == focusedSlot || !isConnected())
+        return;
+
+    // Nothing to move from yet
+    if (focusedSlot < 0)
+    {
+        focusedSlot = slot;
+        return;
+    }
+
+    const int offset = filterOffset(slot) - filterOffset(focusedSlot);
+    const int previous = focusedSlot;
+
+    focusedSlot = slot;
+
+    if (offset == 0 || FilterOffsetMoveS[FILTER_OFFSET_MOVE_ON].s != ISS_ON)
+        return;
+
+    // A focus run measures the new filter by itself
+    if (autofocus.active() || autofocusFinalMove || calibrationStep >= 0)
+    {
+        DEBUGF(INDI::Logger::DBG_WARNING, "AstrofocusFocuser::onFilterSlot => Filter %d selected during a focus run, offset not applied", slot);
+        return;
+    }
+
+    if (holdCorrection())
+    {
+        DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::onFilterSlot => Filter %d to %d during an exposure, %d steps held until the readout",
+               previous, slot, offset);
+
+        heldOffset += offset;
+        publishHeldCorrection();
+        return;
+    }
+
+    const int origin = requestedTarget();
+    const int target = std::max<int>(FocusAbsPosN[0].min, std::min<int>(FocusAbsPosN[0].max, origin + offset));
+
+    if (target == origin)
+        return;
+
+    DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::onFilterSlot => Filter %d to %d%s, moving by %d steps", previous, slot,
+           state == IPS_BUSY ? " while the wheel turns" : "", target - origin);
+
+    FocusAbsPosNP.s = requestMove(target);
+    publishNumber(&FocusAbsPosNP, positionPublisher, true);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::updateFilterLabels(XMLEle *root)
+{
+    bool changed = false;
+
+    for (XMLEle *element = nextXMLEle(root, 1); element != nullptr; element = nextXMLEle(root, 0))
+    {
+        char label[MAXINDILABEL];
+        int slot = 0;
+
+        if (sscanf(findXMLAttValu(element, "name"), "FILTER_SLOT_NAME_%d", &slot) != 1 || slot < 1 || slot > FILTER_SLOTS)
+            continue;
+
+        if (pcdataXMLEle(element)[0] != '\0')
+            snprintf(label, MAXINDILABEL, "%d: %s", slot, pcdataXMLEle(element));
+        else
+            snprintf(label, MAXINDILABEL, "Slot %d", slot);
+
+        if (!strcmp(label, FilterOffsetN[slot - 1].label))
+            continue;
+
+        snprintf(FilterOffsetN[slot - 1].label, MAXINDILABEL, "%s", label);
+        changed = true;
+    }
+
+    if (!changed || !isConnected())
+        return;
+
+    // Clients only read labels when a property is defined
+    deleteProperty(FilterOffsetNP.name);
+    defineProperty(&FilterOffsetNP);
+}
+
+/**************************************************************************************
+ ** Exposure guard
+ ***************************************************************************************/
+void AstrofocusFocuser::snoopCamera()
+{
+    // Another camera, or the same one after a reconnect: it is not exposing until it says so
+    cameraExposing = false;
+    releaseCorrection();
+
+    if (AutofocusCameraT[AUTOFOCUS_CAMERA_DEVICE].text[0] == '\0')
+        return;
+
+    IDSnoopDevice(AutofocusCameraT[AUTOFOCUS_CAMERA_DEVICE].text, "CCD_EXPOSURE");
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::onCameraExposure(IPState state)
+{
+    const bool exposing = (state == IPS_BUSY);
+
+    if (exposing == cameraExposing)
+        return;
+
+    cameraExposing = exposing;
+
+    // Readout and download: the frame is safe, whatever was held can move now
+    if (!exposing)
+        releaseCorrection();
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Only the corrections the driver makes by itself can wait: the temperature
+ * compensation and the filter offsets. Client moves, focus runs and optical
+ * train changes are asked for on purpose and always go out at once.
+ * Returns true when the correction has to wait for the readout.
+ */
+bool AstrofocusFocuser::holdCorrection()
 {
-    float ret = 0;
+    if (ExposureGuardS[EXPOSURE_GUARD_ON].s != ISS_ON || !cameraExposing)
+        return false;
 
-    try
+    if (!correctionHeld)
     {
-        ret = std::stof(str);
-        *has_errors = false;
+        correctionHeld = true;
+        correctionHeldSince = std::chrono::steady_clock::now();
+    }
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Everything held during the exposure goes out as one move. The
+ * compensation is worked out now, on the latest temperature, so the drift
+ * of the whole exposure is corrected by a single net step count.
+ */
+void AstrofocusFocuser::releaseCorrection()
+{
+    if (!correctionHeld)
+        return;
+
+    const int offset = heldOffset;
+
+    correctionHeld = false;
+    heldOffset = 0;
+    publishHeldCorrection();
 
-        DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusFocuser::stringToInt => str: %s converted to %f.", str, ret);
+    // A focus run started in the meantime measures the focus by itself
+    if (autofocus.active() || autofocusFinalMove || calibrationStep >= 0)
+    {
+        DEBUG(INDI::Logger::DBG_WARNING, "AstrofocusFocuser::releaseCorrection => Focus run in progress, held correction dropped");
+        return;
     }
-    catch (std::invalid_argument const &e)
+
+    double predicted = 0;
+    int compensation = 0;
+
+    if (IUFindOnSwitchIndex(&TemperatureCompensationSP) == TEMPERATURE_COMPENSATION_DRIVER && temperatureFilter.ready())
+        compensation = compensationDelta(predicted);
+
+    const int origin = requestedTarget();
+    const int target = std::max<int>(FocusAbsPosN[0].min, std::min<int>(FocusAbsPosN[0].max, origin + offset + compensation));
+
+    if (target == origin)
+        return;
+
+    DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::releaseCorrection => Moving by %d steps, %d of filter offsets and %d of compensation",
+           target - origin, offset, compensation);
+
+    FocusAbsPosNP.s = requestMove(target);
+
+    if (FocusAbsPosNP.s == IPS_BUSY)
+        appliedCompensation += compensation;
+
+    publishNumber(&FocusAbsPosNP, positionPublisher, true);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusFocuser::publishHeldCorrection()
+{
+    double predicted = 0;
+
+    HeldCorrectionN[0].value = 0;
+
+    if (correctionHeld)
     {
-        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::stringToFloat => invalid_argument: %s", e.what());
-        ret = 0;
-        *has_errors = true;
+        HeldCorrectionN[0].value = heldOffset;
+
+        if (IUFindOnSwitchIndex(&TemperatureCompensationSP) == TEMPERATURE_COMPENSATION_DRIVER && temperatureFilter.ready())
+            HeldCorrectionN[0].value += compensationDelta(predicted);
     }
-    catch (std::out_of_range const &e)
+
+    HeldCorrectionNP.s = correctionHeld ? IPS_BUSY : IPS_IDLE;
+    IDSetNumber(&HeldCorrectionNP, nullptr);
+}
+
+/**************************************************************************************
+ ** Shared status
+ ***************************************************************************************/
+bool AstrofocusFocuser::shareStatus(bool enable)
+{
+    if (!enable)
     {
-        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusFocuser::stringToFloat => out_of_range: %s", e.what());
-        ret = 0;
-        *has_errors = true;
+        sharedStatus.close();
+        return true;
     }
 
-    return ret;
+    if (sharedStatus.isOpen())
+        return true;
+
+    if (!sharedStatus.open(getDeviceName()))
+        return false;
+
+    DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusFocuser::shareStatus => Status shared in %s", sharedStatus.name());
+
+    publishSharedStatus();
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Called from the polling loop whenever a position or a temperature comes
+ * in, the readers get every value the driver gets.
+ */
+void AstrofocusFocuser::publishSharedStatus()
+{
+    if (!sharedStatus.isOpen())
+        return;
+
+    uint32_t flags = SHARED_STATUS_CONNECTED;
+
+    if (moveInProgress)
+        flags |= SHARED_STATUS_MOVING;
+
+    if (hasTemperatureSensor && TemperatureNP.s == IPS_OK)
+        flags |= SHARED_STATUS_TEMPERATURE_VALID;
+
+    sharedStatus.publish(flags, lastPosition, requestedTarget(), TemperatureN[0].value);
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusFocuser::saveConfigItems(FILE *fp)
+{
+    INDI::Focuser::saveConfigItems(fp);
+
+    IUSaveConfigSwitch(fp, &TemperatureCompensationSP);
+    IUSaveConfigNumber(fp, &CompensationSettingsNP);
+    IUSaveConfigText(fp, &AutofocusCameraTP);
+    IUSaveConfigNumber(fp, &AutofocusSettingsNP);
+    IUSaveConfigSwitch(fp, &BacklashModeSP);
+    IUSaveConfigSwitch(fp, &TelemetryStreamSP);
+    IUSaveConfigNumber(fp, &PublishLimitsNP);
+    IUSaveConfigNumber(fp, &BacklashSettingsNP);
+    IUSaveConfigText(fp, &TrainNamesTP);
+    IUSaveConfigSwitch(fp, &TrainOffsetMoveSP);
+    IUSaveConfigSwitch(fp, &TrainSP);
+
+    for (int i = 0; i < OPTICAL_TRAINS; i++)
+        IUSaveConfigNumber(fp, &TrainSettingsNP[i]);
+
+    IUSaveConfigText(fp, &FilterWheelTP);
+    IUSaveConfigSwitch(fp, &FilterOffsetMoveSP);
+    IUSaveConfigNumber(fp, &FilterOffsetNP);
+    IUSaveConfigSwitch(fp, &ExposureGuardSP);
+    IUSaveConfigNumber(fp, &ExposureHoldNP);
+    IUSaveConfigSwitch(fp, &SharedStatusSP);
+
+    return true;
 }
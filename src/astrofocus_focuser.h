@@ -20,14 +20,65 @@
 
     #define ASTROFOCUS_FOCUSER_H
 
+    #include <chrono>
+    #include <string>
     #include <indifocuser.h>
     #include "config.h"
+    #include "astrofocus_autofocus.h"
+    #include "astrofocus_motion_model.h"
+    #include "astrofocus_publisher.h"
+    #include "astrofocus_serial_worker.h"
+    #include "astrofocus_settings_cache.h"
+    #include "astrofocus_shared_status_writer.h"
+    #include "astrofocus_snapshot.h"
+    #include "astrofocus_telemetry.h"
+    #include "astrofocus_temperature.h"
 
-    #define MESSAGE_MAX_LENGHT  50
-    #define READ_TIMEOUT        5
+    #define DEVICE_DEFAULT_NAME "Astrofocus"
+
+    #define POLL_MIN_MS         50      // Fastest position polling, used when close to the target
+    #define POLL_MOVE_MAX_MS    2000    // Slowest position polling while a move is running, keeps the clients updated
+    #define POLL_LEAD_FRACTION  0.1     // A moving focuser is polled this much of the remaining time ahead of its ETA
+    #define STALL_TIMEOUT_MS    3000    // A move that doesn't progress for this long is considered stuck
+
+    #define SETTINGS_WRITE_MAX  8       // Settings written by one transaction
+    #define UPPER_LIMIT_MAX     65535
+
+    #define RECONNECT_MIN_MS    1000    // First retry after a failed reconnect, doubled at every failure
+    #define RECONNECT_MAX_MS    60000
+
+    #define TEMPERATURE_POLL_MS 5000    // Temperature sensor polling period
+    #define TEMPERATURE_TAB     "Temperature"
+
+    #define DIAGNOSTICS_PUBLISH_MS  2000    // Diagnostics are published at most this often, and only when they change
+    #define DIAGNOSTICS_TAB     "Diagnostics"
+
+    #define TELEMETRY_STREAM_MS 60000   // Telemetry export period while streaming
+
+    #define PUBLISH_MIN_MS      500     // Default fastest update rate of the polled values, bursts collapse into one update
+    #define PUBLISH_MAX_MS      10000   // Default delay of a change within the deadband
+
+    #define AUTOFOCUS_TAB       "Autofocus"
+    #define AUTOFOCUS_PIPELINE  4       // Exposures whose HFR may still be on its way
+
+    #define BACKLASH_CALIBRATION_SAMPLES    4   // HFR samples of one calibration cycle
+
+    #define OPTICAL_TRAINS      4       // Optical train profiles kept in the configuration
+    #define OPTICAL_TRAINS_TAB  "Optical trains"
+
+    #define FILTER_SLOTS        10      // Filter wheel slots with a focus offset
+    #define FILTERS_TAB         "Filters"
+
+    #define EXPOSURE_HOLD_MAX_S 900     // Default longest hold of a correction, in case the camera never reports the end of an exposure
+
+    #define CAPTURE_ENV         "ASTROFOCUS_CAPTURE"    // Directory the serial sessions are recorded to, when set
 
     class AstrofocusFocuser : public INDI::Focuser
     {
+        // The benchmark and the replay drive the serial layer below the INDI properties
+        friend class AstrofocusBench;
+        friend class AstrofocusReplay;
+
         public:
             AstrofocusFocuser();
             ~AstrofocusFocuser();
@@ -35,20 +86,123 @@
             virtual bool Handshake();
             virtual void ISGetProperties(const char *dev);
             virtual bool ISNewSwitch(const char *dev, const char *name, ISState *states, char *names[], int n) override;
+            virtual bool ISNewNumber(const char *dev, const char *name, double values[], char *names[], int n) override;
+            virtual bool ISNewText(const char *dev, const char *name, char *texts[], char *names[], int n) override;
+            virtual bool ISSnoopDevice(XMLEle *root) override;
+            virtual void TimerHit() override;
         protected:
             const char *getDefaultName();
             bool initProperties() override;
             bool updateProperties() override;
+            bool saveConfigItems(FILE *fp) override;
 
-            int sendCommand(const char *cmd);
-            bool receivedAck();
-            char * receiveResponse();
+            bool SetFocuserMaxPosition(uint32_t ticks) override;
+            IPState MoveAbsFocuser(uint32_t targetTicks) override;
+            IPState MoveRelFocuser(FocusDirection dir, uint32_t ticks) override;
+            bool AbortFocuser() override;
+
+            int queryBatch(const char * const cmds[], char responses[][MESSAGE_MAX_LENGHT], int count, int timeout = READ_TIMEOUT);
 
             void loadSettingsFromDevice();
+            bool resumeSettings();
+            void finishSettingsLoad();
+            void storeInitialTemperature(const char *reply);
+            std::string snapshotPath() const;
+            void saveSnapshot();
+            void startCapture();
+            bool storeSetting(int command, const char *reply);
+            void publishSettings();
+            void reloadSettings();
+
+            struct SettingsWrite
+            {
+                int command;
+                int value;
+            };
+
+            bool applySettings(const SettingsWrite writes[], int count);
+            void completeSettingsTransaction();
+            void applyQueuedSettings();
+            void revertSettings(const SettingsWrite writes[], int count, IPState state);
+            void setSettingState(int command, IPState state);
+            static bool isWritableSetting(int command, int value);
+
+            static void onSerialCompletion(const AstrofocusSerialWorker::Completion &completion, void *context);
+            void handleCompletion(const AstrofocusSerialWorker::Completion &completion);
+
+            static void onReconnectTimer(void *context);
+            void scheduleReconnect();
+            void reconnect();
+            void dropLink();
 
-            int stringToInt(const char *str, bool * has_errors);
-            float stringToFloat(const char *str, bool * has_errors);
+            IPState requestMove(int target);
+            bool sendMove(int target);
+            int requestedTarget() const;
+
+            void processPosition(int position, bool valid);
+            void startMove();
+            void schedulePoll(uint32_t ms);
+            uint32_t nextPollInterval(int position);
+            double remainingMoveMs(int position) const;
+            void publishMoveEta(int position);
+            void configureMotionModel();
+            void finishMove(IPState state);
+
+            void publishDiagnostics(bool force);
+
+            void applyPublishLimits();
+            void publishNumber(INumberVectorProperty *property, AstrofocusPublisher &publisher, bool force = false);
+            void flushPublications();
+
+            void recordTelemetry(int latency_ms);
+            bool exportTelemetry();
+
+            bool startAutofocus();
+            void stopAutofocus(IPState state, const char *message);
+            void advanceAutofocus();
+            void onExposureState(IPState state);
+            void onHfrMeasured(double hfr);
+            void failMeasurement(const char *message);
+
+            uint32_t backlashApproach(uint32_t target) const;
+            bool startBacklashCalibration();
+            void stopBacklashCalibration(IPState state, const char *message);
+            void advanceBacklashCalibration();
+            void completeBacklashCalibration();
+
+            void processTemperature(float temperature, bool valid);
+            void applyTemperatureCompensation();
+            void resetTemperatureCompensation();
+
+            bool applyOpticalTrain(int index, int previous);
+            void updateOpticalTrainLabels();
+
+            void snoopFilterWheel();
+            void onFilterSlot(int slot, IPState state);
+            void updateFilterLabels(XMLEle *root);
+            int filterOffset(int slot) const;
+
+            void snoopCamera();
+            void onCameraExposure(IPState state);
+            bool holdCorrection();
+            void releaseCorrection();
+            void publishHeldCorrection();
+            int compensationDelta(double &predicted) const;
+
+            bool shareStatus(bool enable);
+            void publishSharedStatus();
         private:
+            enum
+            {
+                SERIAL_TAG_POSITION,
+                SERIAL_TAG_MOVE,
+                SERIAL_TAG_ABORT_POSITION,
+                SERIAL_TAG_SETTINGS_WRITE,
+                SERIAL_TAG_TEMPERATURE,
+                SERIAL_TAG_TEMPERATURE_COMPENSATION,
+                SERIAL_TAG_SETTING_READ
+            };
+
             enum
             {
                 STEPPER_MODE_ONE_PHASE_FULL_STEP,
@@ -57,6 +211,30 @@
                 STEPPER_MODE_COUNT
             };
 
+            enum
+            {
+                MOTOR_STEPPER_POWER,
+                MOTOR_PULSES_DURATION,
+                MOTOR_POWER_CUT_PAUSE,
+                MOTOR_SETTINGS_COUNT
+            };
+
+            enum
+            {
+                TEMPERATURE_COMPENSATION_OFF,
+                TEMPERATURE_COMPENSATION_FIRMWARE,
+                TEMPERATURE_COMPENSATION_DRIVER,
+                TEMPERATURE_COMPENSATION_COUNT
+            };
+
+            enum
+            {
+                COMPENSATION_STEPS_PER_DEGREE,
+                COMPENSATION_MIN_MOVE,
+                COMPENSATION_LEAD_TIME,
+                COMPENSATION_SETTINGS_COUNT
+            };
+
             ISwitch StepperModeS[STEPPER_MODE_COUNT];
             ISwitchVectorProperty StepperModeSP;
 
@@ -65,5 +243,327 @@
 
             IText FirmwareVersionT[1] {};
             ITextVectorProperty FirmwareVersionTP;
+
+            INumber MotorSettingsN[MOTOR_SETTINGS_COUNT] {};
+            INumberVectorProperty MotorSettingsNP;
+
+            ISwitch ReloadSettingsS[1];
+            ISwitchVectorProperty ReloadSettingsSP;
+
+            enum
+            {
+                LINK_BATCHES,
+                LINK_BYTES_OUT,
+                LINK_BYTES_IN,
+                LINK_TIMEOUTS,
+                LINK_RESYNCS,
+                LINK_STALE_REPLIES,
+                LINK_DROPPED_LINES,
+                LINK_COALESCED,
+                LINK_DIAGNOSTICS_COUNT
+            };
+
+            enum
+            {
+                COMMAND_STATS_COUNT,
+                COMMAND_STATS_ERRORS,
+                COMMAND_STATS_P50,
+                COMMAND_STATS_P99,
+                COMMAND_STATS_MAX,
+                COMMAND_STATS_PROPERTIES
+            };
+
+            INumber LinkDiagnosticsN[LINK_DIAGNOSTICS_COUNT] {};
+            INumberVectorProperty LinkDiagnosticsNP;
+
+            INumber CommandStatsN[COMMAND_STATS_PROPERTIES][COMMAND_COUNT] {};
+            INumberVectorProperty CommandStatsNP[COMMAND_STATS_PROPERTIES];
+
+            ISwitch ResetDiagnosticsS[1];
+            ISwitchVectorProperty ResetDiagnosticsSP;
+
+            enum
+            {
+                TELEMETRY_STREAM_ON,
+                TELEMETRY_STREAM_OFF,
+                TELEMETRY_STREAM_COUNT
+            };
+
+            IBLOB TelemetryB[1] {};
+            IBLOBVectorProperty TelemetryBP;
+
+            ISwitch TelemetryExportS[1];
+            ISwitchVectorProperty TelemetryExportSP;
+
+            ISwitch TelemetryStreamS[TELEMETRY_STREAM_COUNT];
+            ISwitchVectorProperty TelemetryStreamSP;
+
+            enum
+            {
+                PUBLISH_POSITION_DEADBAND,
+                PUBLISH_TEMPERATURE_DEADBAND,
+                PUBLISH_MIN_INTERVAL,
+                PUBLISH_MAX_INTERVAL,
+                PUBLISH_LIMITS_COUNT
+            };
+
+            INumber PublishLimitsN[PUBLISH_LIMITS_COUNT] {};
+            INumberVectorProperty PublishLimitsNP;
+
+            enum
+            {
+                AUTOFOCUS_CAMERA_DEVICE,
+                AUTOFOCUS_CAMERA_PROPERTY,
+                AUTOFOCUS_CAMERA_ELEMENT,
+                AUTOFOCUS_CAMERA_COUNT
+            };
+
+            enum
+            {
+                AUTOFOCUS_COARSE_STEP,
+                AUTOFOCUS_COARSE_POINTS,
+                AUTOFOCUS_FINE_STEP,
+                AUTOFOCUS_FINE_POINTS,
+                AUTOFOCUS_SETTINGS_COUNT
+            };
+
+            enum
+            {
+                AUTOFOCUS_START,
+                AUTOFOCUS_ABORT,
+                AUTOFOCUS_COUNT
+            };
+
+            enum
+            {
+                AUTOFOCUS_RESULT_POSITION,
+                AUTOFOCUS_RESULT_HFR,
+                AUTOFOCUS_RESULT_COUNT
+            };
+
+            IText AutofocusCameraT[AUTOFOCUS_CAMERA_COUNT] {};
+            ITextVectorProperty AutofocusCameraTP;
+
+            INumber AutofocusSettingsN[AUTOFOCUS_SETTINGS_COUNT] {};
+            INumberVectorProperty AutofocusSettingsNP;
+
+            ISwitch AutofocusS[AUTOFOCUS_COUNT];
+            ISwitchVectorProperty AutofocusSP;
+
+            INumber AutofocusResultN[AUTOFOCUS_RESULT_COUNT] {};
+            INumberVectorProperty AutofocusResultNP;
+
+            enum
+            {
+                BACKLASH_OFF,
+                BACKLASH_FINAL_OUTWARD,
+                BACKLASH_FINAL_INWARD,
+                BACKLASH_MODE_COUNT
+            };
+
+            enum
+            {
+                BACKLASH_INWARD,
+                BACKLASH_OUTWARD,
+                BACKLASH_MARGIN,
+                BACKLASH_CALIBRATION_STEP,
+                BACKLASH_SETTINGS_COUNT
+            };
+
+            enum
+            {
+                MOVE_ETA_REMAINING,
+                MOVE_ETA_STEP_TIME,
+                MOVE_ETA_COUNT
+            };
+
+            INumber MoveEtaN[MOVE_ETA_COUNT] {};
+            INumberVectorProperty MoveEtaNP;
+
+            ISwitch BacklashModeS[BACKLASH_MODE_COUNT];
+            ISwitchVectorProperty BacklashModeSP;
+
+            INumber BacklashSettingsN[BACKLASH_SETTINGS_COUNT] {};
+            INumberVectorProperty BacklashSettingsNP;
+
+            ISwitch BacklashCalibrateS[1];
+            ISwitchVectorProperty BacklashCalibrateSP;
+
+            INumber TemperatureN[1] {};
+            INumberVectorProperty TemperatureNP;
+
+            ISwitch TemperatureCompensationS[TEMPERATURE_COMPENSATION_COUNT];
+            ISwitchVectorProperty TemperatureCompensationSP;
+
+            INumber TemperatureCoefficientN[1] {};
+            INumberVectorProperty TemperatureCoefficientNP;
+
+            INumber CompensationSettingsN[COMPENSATION_SETTINGS_COUNT] {};
+            INumberVectorProperty CompensationSettingsNP;
+
+            enum
+            {
+                TRAIN_STEP_SIZE,
+                TRAIN_STEPPER_MODE,
+                TRAIN_STEPPER_POWER,
+                TRAIN_PULSES_DURATION,
+                TRAIN_POWER_CUT_PAUSE,
+                TRAIN_FOCUS_OFFSET,
+                TRAIN_SETTINGS_COUNT
+            };
+
+            enum
+            {
+                TRAIN_OFFSET_MOVE_ON,
+                TRAIN_OFFSET_MOVE_OFF,
+                TRAIN_OFFSET_MOVE_COUNT
+            };
+
+            IText TrainNamesT[OPTICAL_TRAINS] {};
+            ITextVectorProperty TrainNamesTP;
+
+            INumber TrainSettingsN[OPTICAL_TRAINS][TRAIN_SETTINGS_COUNT] {};
+            INumberVectorProperty TrainSettingsNP[OPTICAL_TRAINS];
+
+            ISwitch TrainS[OPTICAL_TRAINS];
+            ISwitchVectorProperty TrainSP;
+
+            ISwitch TrainOffsetMoveS[TRAIN_OFFSET_MOVE_COUNT];
+            ISwitchVectorProperty TrainOffsetMoveSP;
+
+            enum
+            {
+                FILTER_OFFSET_MOVE_ON,
+                FILTER_OFFSET_MOVE_OFF,
+                FILTER_OFFSET_MOVE_COUNT
+            };
+
+            IText FilterWheelT[1] {};
+            ITextVectorProperty FilterWheelTP;
+
+            INumber FilterOffsetN[FILTER_SLOTS] {};
+            INumberVectorProperty FilterOffsetNP;
+
+            ISwitch FilterOffsetMoveS[FILTER_OFFSET_MOVE_COUNT];
+            ISwitchVectorProperty FilterOffsetMoveSP;
+
+            enum
+            {
+                EXPOSURE_GUARD_ON,
+                EXPOSURE_GUARD_OFF,
+                EXPOSURE_GUARD_COUNT
+            };
+
+            ISwitch ExposureGuardS[EXPOSURE_GUARD_COUNT];
+            ISwitchVectorProperty ExposureGuardSP;
+
+            INumber ExposureHoldN[1] {};
+            INumberVectorProperty ExposureHoldNP;
+
+            INumber HeldCorrectionN[1] {};
+            INumberVectorProperty HeldCorrectionNP;
+
+            enum
+            {
+                SHARED_STATUS_ON,
+                SHARED_STATUS_OFF,
+                SHARED_STATUS_COUNT
+            };
+
+            ISwitch SharedStatusS[SHARED_STATUS_COUNT];
+            ISwitchVectorProperty SharedStatusSP;
+
+            AstrofocusSerialWorker serialWorker;
+            AstrofocusSettingsCache settingsCache;
+            AstrofocusSnapshot snapshot;
+            int reloadPending { 0 };
+
+            // Settings transaction, all its writes go out in one batch and are rolled back together
+            struct SettingsTransaction
+            {
+                int count { 0 };            // Writes of the running transaction, 0 if none
+                int pending { 0 };          // Acks still to come, of the writes or of the rollback
+                bool failed { false };
+                bool rollingBack { false };
+                SettingsWrite writes[SETTINGS_WRITE_MAX];
+                SettingsWrite previous[SETTINGS_WRITE_MAX];
+                bool hasPrevious[SETTINGS_WRITE_MAX];
+            };
+
+            SettingsTransaction settingsTransaction;
+            SettingsWrite queuedSettings[SETTINGS_WRITE_MAX];
+            int queuedSettingsCount { 0 };
+
+            // Link supervision
+            int reconnectTimerID { -1 };
+            uint32_t reconnectDelay { 0 };
+
+            // Move engine
+            int pollTimerID { -1 };
+            bool positionQueryPending { false };
+            bool moveInProgress { false };
+            int targetPosition { 0 };
+            int approachTarget { -1 };     // Final leg of an overshoot move, -1 if none
+            int queuedTarget { -1 };       // Latest requested target waiting for the command in flight, -1 if none
+            bool moveCommandPending { false };
+            bool abortPending { false };
+            int lastPosition { 0 };
+            int moveStartPosition { 0 };   // Start of the running leg
+            std::chrono::steady_clock::time_point moveStartTime;
+            std::chrono::steady_clock::time_point lastProgressTime;
+            AstrofocusMotionModel motionModel;
+
+            // Polled values sent to the clients
+            AstrofocusPublisher positionPublisher;
+            AstrofocusPublisher temperaturePublisher;
+            AstrofocusPublisher etaPublisher;
+
+            uint32_t publishedDiagnostics { 0 };
+            std::chrono::steady_clock::time_point lastDiagnosticsPublish;
+
+            // Telemetry
+            AstrofocusTelemetry telemetry;
+            AstrofocusTelemetry::Sample lastTelemetry {};
+            std::chrono::steady_clock::time_point positionQueryTime;
+            std::chrono::steady_clock::time_point lastTelemetrySample;
+            std::chrono::steady_clock::time_point lastTelemetryExport;
+
+            // Autofocus
+            AstrofocusAutofocus autofocus;
+            bool autofocusWaitingExposure { false };
+            bool autofocusExposureStarted { false };
+            bool autofocusFinalMove { false };
+            int autofocusPending[AUTOFOCUS_PIPELINE] {};  // Positions, or calibration steps, waiting for their HFR
+            int autofocusPendingCount { 0 };
+
+            // Backlash calibration, shares the exposure pipeline of the autofocus
+            int calibrationStep { -1 };
+            int calibrationOrigin { 0 };
+            int calibrationReceived { 0 };
+            double calibrationSamples[BACKLASH_CALIBRATION_SAMPLES] {};
+
+            // Temperature
+            bool hasTemperatureSensor { false };
+            bool temperatureQueryPending { false };
+            int pendingCompensationIndex { 0 };
+            std::chrono::steady_clock::time_point lastTemperaturePoll;
+            AstrofocusTemperatureFilter temperatureFilter;
+            double referenceTemperature { 0 };
+            int appliedCompensation { 0 };
+
+            // Optical trains
+            bool restoringTrain { false };
+
+            // Filter offsets
+            int focusedSlot { -1 };     // Filter the focus offset was last applied for, from 1, -1 if not known yet
+
+            // Exposure guard
+            bool cameraExposing { false };
+            bool correctionHeld { false };
+            int heldOffset { 0 };       // Filter offsets waiting for the readout, the compensation is worked out on release
+            std::chrono::steady_clock::time_point correctionHeldSince;
+
+            // Status for the clients on the same host
+            AstrofocusSharedStatusWriter sharedStatus;
     };
 #endif
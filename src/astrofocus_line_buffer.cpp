@@ -0,0 +1,142 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+#include "astrofocus_line_buffer.h"
+
+/* ************************************************************************************ */
+
+void AstrofocusLineBuffer::clear()
+{
+    head = tail = 0;
+    resynchronising = false;
+}
+
+/* ************************************************************************************ */
+
+ssize_t AstrofocusLineBuffer::fill(int fd)
+{
+    ssize_t nbytes_read;
+
+    if (tail == LINE_BUFFER_SIZE)
+    {
+        if (head == 0)
+        {
+            // A full buffer without a single terminator is garbage, skip up to the next one
+            head = tail = 0;
+            resynchronising = true;
+            dropped++;
+        }
+        else
+        {
+            memmove(data, data + head, tail - head);
+            tail -= head;
+            head = 0;
+        }
+    }
+
+    nbytes_read = read(fd, data + tail, LINE_BUFFER_SIZE - tail);
+
+    if (nbytes_read > 0)
+        tail += nbytes_read;
+
+    return nbytes_read;
+}
+
+/* ************************************************************************************ */
+
+std::string_view AstrofocusLineBuffer::recent(size_t count) const
+{
+    count = std::min(count, tail);
+
+    return std::string_view(data + tail - count, count);
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusLineBuffer::nextLine(std::string_view &line, bool &garbled)
+{
+    const char *start = data + head;
+    const char *end = static_cast<const char *>(memchr(start, '\n', tail - head));
+    size_t length;
+    bool printable = true;
+
+    if (end == nullptr)
+        return false;
+
+    length = end - start;
+    head += length + 1;
+
+    if (length > 0 && start[length - 1] == '\r')
+        length--;
+
+    for (size_t i = 0; i < length && printable; i++)
+        printable = (start[i] >= 0x20 && start[i] < 0x7f);
+
+    if (head == tail)
+        head = tail = 0;
+
+    // The tail of an overflowed run, or line noise: not a reply
+    garbled = (resynchronising || !printable);
+
+    if (garbled)
+    {
+        resynchronising = false;
+        dropped++;
+        line = std::string_view();
+    }
+    else
+        line = std::string_view(start, length);
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+int AstrofocusLineBuffer::discardLines()
+{
+    std::string_view line;
+    bool garbled;
+    int count = 0;
+
+    while (nextLine(line, garbled))
+    {
+        if (!garbled)
+            count++;
+    }
+
+    return count;
+}
+
+/* ************************************************************************************ */
+
+size_t AstrofocusLineBuffer::size() const
+{
+    return tail - head;
+}
+
+/* ************************************************************************************ */
+
+unsigned long AstrofocusLineBuffer::droppedLines() const
+{
+    return dropped;
+}
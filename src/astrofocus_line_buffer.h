@@ -0,0 +1,69 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_LINE_BUFFER_H
+
+    #define ASTROFOCUS_LINE_BUFFER_H
+
+    #include <cstddef>
+    #include <string_view>
+    #include <sys/types.h>
+
+    #define LINE_BUFFER_SIZE    1024
+
+    /**
+     * Persistent receive buffer of a serial connection.
+     * Data is appended at the tail and complete lines are consumed from the
+     * head, the unread bytes are moved back to the start only when the tail
+     * reaches the end of the storage. Lines are handed out as views over the
+     * internal storage, they stay valid until the next fill() or clear().
+     *
+     * Partial lines are kept across reads. Lines with non printable bytes
+     * and runs of data too long to be a reply are dropped, the framing
+     * resynchronises on the next '\n'. A dropped line is still reported to
+     * the caller, it may have been one reply or several merged together.
+     */
+    class AstrofocusLineBuffer
+    {
+        public:
+            void clear();
+
+            // Reads what is available on fd, returns the bytes read or -1 (see errno)
+            ssize_t fill(int fd);
+
+            // The last count bytes appended, only valid right after fill()
+            std::string_view recent(size_t count) const;
+
+            // Extracts the next complete line, without its terminator, garbled is set when it was dropped
+            bool nextLine(std::string_view &line, bool &garbled);
+
+            // Drops the complete lines still buffered, returns how many
+            int discardLines();
+
+            size_t size() const;
+            unsigned long droppedLines() const;
+
+        private:
+            char data[LINE_BUFFER_SIZE];
+            size_t head { 0 };
+            size_t tail { 0 };
+
+            bool resynchronising { false };
+            unsigned long dropped { 0 };
+    };
+#endif
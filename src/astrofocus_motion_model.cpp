@@ -0,0 +1,87 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+
+#include "astrofocus_motion_model.h"
+
+/* ************************************************************************************ */
+
+void AstrofocusMotionModel::configure(int pulse_ms, int motion_mode)
+{
+    if (pulse_ms == pulseDuration && motion_mode == motionMode)
+        return;
+
+    pulseDuration = pulse_ms;
+    motionMode = motion_mode;
+
+    // One pulse per position unit in every mode, the measurements correct whatever the firmware really does
+    overheadMs = MOTION_MODEL_OVERHEAD;
+    stepMs = std::max(1, pulse_ms);
+
+    weight = sumX = sumY = sumXX = sumXY = 0;
+}
+
+/* ************************************************************************************ */
+
+double AstrofocusMotionModel::predictMs(int steps) const
+{
+    if (steps == 0)
+        return 0;
+
+    return overheadMs + std::abs(steps) * stepMs;
+}
+
+double AstrofocusMotionModel::msPerStep() const
+{
+    return stepMs;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusMotionModel::learn(int steps, double elapsed_ms)
+{
+    const double x = std::abs(steps);
+
+    if (x == 0 || elapsed_ms <= 0)
+        return;
+
+    weight = weight * MOTION_MODEL_FORGET + 1;
+    sumX = sumX * MOTION_MODEL_FORGET + x;
+    sumY = sumY * MOTION_MODEL_FORGET + elapsed_ms;
+    sumXX = sumXX * MOTION_MODEL_FORGET + x * x;
+    sumXY = sumXY * MOTION_MODEL_FORGET + x * elapsed_ms;
+
+    const double denominator = weight * sumXX - sumX * sumX;
+
+    // Until the moves have different lengths only the time per step can be told, the overhead stays
+    if (denominator <= 1e-6 * weight * sumXX)
+    {
+        stepMs = std::max(0.01, (sumY - weight * overheadMs) / sumX);
+        return;
+    }
+
+    const double slope = (weight * sumXY - sumX * sumY) / denominator;
+
+    if (slope <= 0)
+        return;
+
+    stepMs = slope;
+    overheadMs = std::max(0., (sumY - slope * sumX) / weight);
+}
@@ -0,0 +1,58 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_MOTION_MODEL_H
+
+    #define ASTROFOCUS_MOTION_MODEL_H
+
+    #define MOTION_MODEL_FORGET     0.9     // Weight kept by the older samples at every new one
+    #define MOTION_MODEL_OVERHEAD   20.     // Prior of the fixed cost of a move, in ms
+
+    /**
+     * Predicts how long a move takes: a fixed overhead plus a time per step.
+     * The prior is one pulse per step and starts over when the motor
+     * settings change, then a least squares line through the measured
+     * (steps, ms) points takes over, older points fading out so the model
+     * follows the mechanics.
+     */
+    class AstrofocusMotionModel
+    {
+        public:
+            // Resets the model if the motor settings have changed
+            void configure(int pulse_ms, int motion_mode);
+
+            double predictMs(int steps) const;
+            double msPerStep() const;
+
+            // A point of a running move: the steps done so far and the time taken since its start
+            void learn(int steps, double elapsed_ms);
+
+        private:
+            int pulseDuration { -1 };
+            int motionMode { -1 };
+
+            double overheadMs { MOTION_MODEL_OVERHEAD };
+            double stepMs { 1 };
+
+            double weight { 0 };
+            double sumX { 0 };
+            double sumY { 0 };
+            double sumXX { 0 };
+            double sumXY { 0 };
+    };
+#endif
@@ -0,0 +1,393 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_PROTOCOL_H
+
+    #define ASTROFOCUS_PROTOCOL_H
+
+    #include <charconv>
+    #include <cstdlib>
+    #include <cstring>
+    #include <string_view>
+
+    // Command codes, see the list at the top of astrofocus_focuser.cpp
+    enum AstrofocusCommand
+    {
+        COMMAND_POSITION,
+        COMMAND_GOTO,
+        COMMAND_MOVE_RELATIVE,
+        COMMAND_SET_LOWER_LIMIT,
+        COMMAND_UPPER_LIMIT,
+        COMMAND_TEMPERATURE,
+        COMMAND_TEMPERATURE_COEFFICIENT,
+        COMMAND_TEMPERATURE_COMPENSATION,
+        COMMAND_STEP_SIZE,
+        COMMAND_VERSION,
+        COMMAND_STEPPER_POWER,
+        COMMAND_PULSES_DURATION,
+        COMMAND_PAUSE,
+        COMMAND_MOTION_MODE,
+        COMMAND_COUNT
+    };
+
+    enum ReplyType
+    {
+        REPLY_NONE,     // Nothing to read: the argument 0 is not a query
+        REPLY_OK,       // "OK" acknowledges the command
+        REPLY_INT,
+        REPLY_FLOAT,
+        REPLY_FLAG,     // "T" or "F"
+        REPLY_TEXT
+    };
+
+    /**
+     * What the firmware takes and answers for one command code. On most
+     * commands the argument 0 is a query, the others set something and must
+     * be within [minArgument, maxArgument]: an empty range means the command
+     * can only be queried.
+     */
+    struct CommandSpec
+    {
+        AstrofocusCommand code;
+        const char *name;           // Stable, used to label per-command properties
+        ReplyType queryReply;       // Reply to the argument 0
+        int minArgument;
+        int maxArgument;
+        ReplyType setReply;         // Reply to the other arguments
+    };
+
+    inline constexpr CommandSpec commandSpecs[COMMAND_COUNT] =
+    {
+        { COMMAND_POSITION, "POSITION", REPLY_INT, 1, 65535, REPLY_OK },
+        { COMMAND_GOTO, "GOTO", REPLY_NONE, 0, 65535, REPLY_OK },
+        { COMMAND_MOVE_RELATIVE, "MOVE_RELATIVE", REPLY_NONE, -65535, 65535, REPLY_OK },
+        { COMMAND_SET_LOWER_LIMIT, "SET_LOWER_LIMIT", REPLY_NONE, 0, 0, REPLY_OK },
+        { COMMAND_UPPER_LIMIT, "UPPER_LIMIT", REPLY_INT, 1, 65535, REPLY_OK },
+        { COMMAND_TEMPERATURE, "TEMPERATURE", REPLY_FLAG, 1, 1, REPLY_FLOAT },
+        { COMMAND_TEMPERATURE_COEFFICIENT, "TEMPERATURE_COEFFICIENT", REPLY_INT, -32768, 32767, REPLY_OK },
+        { COMMAND_TEMPERATURE_COMPENSATION, "TEMPERATURE_COMPENSATION", REPLY_NONE, 0, 1, REPLY_OK },
+        { COMMAND_STEP_SIZE, "STEP_SIZE", REPLY_INT, -32768, 32767, REPLY_OK },
+        { COMMAND_VERSION, "VERSION", REPLY_TEXT, 1, 0, REPLY_NONE },
+        { COMMAND_STEPPER_POWER, "STEPPER_POWER", REPLY_INT, 1, 255, REPLY_OK },
+        { COMMAND_PULSES_DURATION, "PULSES_DURATION", REPLY_INT, 1, 65535, REPLY_OK },
+        { COMMAND_PAUSE, "PAUSE", REPLY_INT, 1, 65535, REPLY_OK },
+        { COMMAND_MOTION_MODE, "MOTION_MODE", REPLY_INT, 1, 3, REPLY_OK }
+    };
+
+    constexpr bool commandSpecsInOrder()
+    {
+        for (int code = 0; code < COMMAND_COUNT; code++)
+        {
+            if (commandSpecs[code].code != code)
+                return false;
+        }
+
+        return true;
+    }
+
+    static_assert(commandSpecsInOrder(), "commandSpecs must be indexed by the command code");
+
+    inline const char *commandName(int code)
+    {
+        return (code >= 0 && code < COMMAND_COUNT) ? commandSpecs[code].name : "UNKNOWN";
+    }
+
+    constexpr bool isQuery(int code, int argument)
+    {
+        return argument == 0 && commandSpecs[code].queryReply != REPLY_NONE;
+    }
+
+    constexpr bool isValidCommand(int code, int argument)
+    {
+        if (code < 0 || code >= COMMAND_COUNT)
+            return false;
+
+        return isQuery(code, argument) || (argument >= commandSpecs[code].minArgument && argument <= commandSpecs[code].maxArgument);
+    }
+
+    constexpr ReplyType replyType(int code, int argument)
+    {
+        return isQuery(code, argument) ? commandSpecs[code].queryReply : commandSpecs[code].setReply;
+    }
+
+    /* ************************************************************************************ */
+
+    constexpr int decimalLength(int value)
+    {
+        int length = (value < 0) ? 2 : 1;
+
+        for (value /= 10; value != 0; value /= 10)
+            length++;
+
+        return length;
+    }
+
+    constexpr void writeDecimal(char *out, int length, int value)
+    {
+        long magnitude = value;
+
+        if (magnitude < 0)
+        {
+            out[0] = '-';
+            magnitude = -magnitude;
+        }
+
+        for (int i = length - 1; i >= 0 && out[i] != '-'; i--, magnitude /= 10)
+            out[i] = '0' + magnitude % 10;
+    }
+
+    /**
+     * A command spelled out at compile time. An argument the firmware doesn't
+     * take fails the build instead of reaching the focuser.
+     */
+    template <int Code, int Argument>
+    struct CommandLiteral
+    {
+        static_assert(isValidCommand(Code, Argument), "Not a valid AstroFocus command");
+
+        static constexpr int length = decimalLength(Code) + 1 + decimalLength(Argument);
+
+        char text[length + 1] {};
+
+        constexpr CommandLiteral()
+        {
+            writeDecimal(text, decimalLength(Code), Code);
+            text[decimalLength(Code)] = ',';
+            writeDecimal(text + decimalLength(Code) + 1, decimalLength(Argument), Argument);
+        }
+    };
+
+    template <int Code, int Argument>
+    inline constexpr CommandLiteral<Code, Argument> commandLiteral {};
+
+    // "code,argument" of a fixed command, e.g. commandText<COMMAND_POSITION, 0>() for "0,0"
+    template <int Code, int Argument>
+    constexpr const char *commandText()
+    {
+        return commandLiteral<Code, Argument>.text;
+    }
+
+    static_assert(std::string_view(commandLiteral<COMMAND_MOVE_RELATIVE, -120>.text) == "2,-120", "Command literals are misspelled");
+
+    /**
+     * Writes "code,argument" into buffer, terminator included. Returns the
+     * length, or 0 if the firmware doesn't take the command or the buffer
+     * is too small.
+     */
+    inline size_t encodeCommand(char *buffer, size_t size, int code, int argument)
+    {
+        if (size == 0 || !isValidCommand(code, argument))
+            return 0;
+
+        char *end = buffer + size - 1;
+        std::to_chars_result result = std::to_chars(buffer, end, code);
+
+        if (result.ec != std::errc() || result.ptr == end)
+            return 0;
+
+        *result.ptr++ = ',';
+        result = std::to_chars(result.ptr, end, argument);
+
+        if (result.ec != std::errc())
+            return 0;
+
+        *result.ptr = '\0';
+
+        return result.ptr - buffer;
+    }
+
+    /**
+     * A parsed reply: either a value or nothing. Parsing never throws and
+     * never allocates, so it is safe on the polling path.
+     */
+    template <typename T>
+    struct Expected
+    {
+        T value {};
+        bool valid { false };
+
+        explicit operator bool() const
+        {
+            return valid;
+        }
+
+        T valueOr(T fallback) const
+        {
+            return valid ? value : fallback;
+        }
+    };
+
+    inline std::string_view trimReply(std::string_view reply)
+    {
+        while (!reply.empty() && (reply.front() == ' ' || reply.front() == '\t'))
+            reply.remove_prefix(1);
+
+        while (!reply.empty() && (reply.back() == ' ' || reply.back() == '\t' || reply.back() == '\r' || reply.back() == '\n'))
+            reply.remove_suffix(1);
+
+        return reply;
+    }
+
+    inline Expected<int> parseInt(std::string_view reply)
+    {
+        Expected<int> result;
+
+        reply = trimReply(reply);
+
+        // from_chars doesn't accept a leading '+'
+        if (!reply.empty() && reply.front() == '+')
+            reply.remove_prefix(1);
+
+        const char *end = reply.data() + reply.size();
+        auto parsed = std::from_chars(reply.data(), end, result.value);
+
+        result.valid = (!reply.empty() && parsed.ec == std::errc() && parsed.ptr == end);
+
+        return result;
+    }
+
+    inline Expected<float> parseFloat(std::string_view reply)
+    {
+        Expected<float> result;
+
+        reply = trimReply(reply);
+
+        if (!reply.empty() && reply.front() == '+')
+            reply.remove_prefix(1);
+
+        if (reply.empty())
+            return result;
+
+        const char *end = reply.data() + reply.size();
+
+        #if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+        auto parsed = std::from_chars(reply.data(), end, result.value);
+
+        result.valid = (parsed.ec == std::errc() && parsed.ptr == end);
+        #else
+        // Older standard libraries only have the integer overloads of from_chars
+        char buffer[32];
+        char *parsed_end = nullptr;
+
+        if (reply.size() >= sizeof(buffer))
+            return result;
+
+        memcpy(buffer, reply.data(), reply.size());
+        buffer[reply.size()] = '\0';
+
+        result.value = strtof(buffer, &parsed_end);
+        result.valid = (parsed_end == buffer + reply.size());
+        (void)end;
+        #endif
+
+        return result;
+    }
+
+    /**
+     * Reply decoders, one per reply type. They never throw and never
+     * allocate: a text reply is a view into the buffer it was read into.
+     */
+    template <ReplyType Type>
+    struct ReplyDecoder;
+
+    template <>
+    struct ReplyDecoder<REPLY_OK>
+    {
+        static Expected<bool> decode(std::string_view reply)
+        {
+            const bool ok = (trimReply(reply) == "OK");
+
+            return { ok, ok };
+        }
+    };
+
+    template <>
+    struct ReplyDecoder<REPLY_INT>
+    {
+        static Expected<int> decode(std::string_view reply)
+        {
+            return parseInt(reply);
+        }
+    };
+
+    template <>
+    struct ReplyDecoder<REPLY_FLOAT>
+    {
+        static Expected<float> decode(std::string_view reply)
+        {
+            return parseFloat(reply);
+        }
+    };
+
+    template <>
+    struct ReplyDecoder<REPLY_FLAG>
+    {
+        static Expected<bool> decode(std::string_view reply)
+        {
+            reply = trimReply(reply);
+
+            return { reply == "T", reply == "T" || reply == "F" };
+        }
+    };
+
+    template <>
+    struct ReplyDecoder<REPLY_TEXT>
+    {
+        static Expected<std::string_view> decode(std::string_view reply)
+        {
+            reply = trimReply(reply);
+
+            return { reply, !reply.empty() };
+        }
+    };
+
+    // Decodes the reply to a fixed command with the type the table gives it
+    template <int Code, int Argument = 0>
+    auto decodeReply(std::string_view reply)
+    {
+        static_assert(isValidCommand(Code, Argument), "Not a valid AstroFocus command");
+        static_assert(replyType(Code, Argument) != REPLY_NONE, "The command has no reply to decode");
+
+        return ReplyDecoder<replyType(Code, Argument)>::decode(reply);
+    }
+
+    inline bool isAcknowledged(std::string_view reply)
+    {
+        return static_cast<bool>(ReplyDecoder<REPLY_OK>::decode(reply));
+    }
+
+    // Splits a "code,argument" command as it was sent to the focuser
+    inline bool parseCommand(std::string_view command, int *code, int *argument)
+    {
+        size_t comma = command.find(',');
+
+        if (comma == std::string_view::npos)
+            return false;
+
+        Expected<int> parsed_code = parseInt(command.substr(0, comma));
+        Expected<int> parsed_argument = parseInt(command.substr(comma + 1));
+
+        if (!parsed_code || !parsed_argument || parsed_code.value < 0 || parsed_code.value >= COMMAND_COUNT)
+            return false;
+
+        *code = parsed_code.value;
+        *argument = parsed_argument.value;
+
+        return true;
+    }
+#endif
@@ -0,0 +1,101 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+
+#include "astrofocus_publisher.h"
+
+/* ************************************************************************************ */
+
+void AstrofocusPublisher::setLimits(double deadband, uint32_t min_interval_ms, uint32_t max_interval_ms)
+{
+    this->deadband = std::max(0., deadband);
+    minInterval = std::chrono::milliseconds(min_interval_ms);
+    maxInterval = std::chrono::milliseconds(std::max(min_interval_ms, max_interval_ms));
+}
+
+void AstrofocusPublisher::reset()
+{
+    valid = false;
+    held = heldSignificant = false;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusPublisher::update(const INumberVectorProperty &property, std::chrono::steady_clock::time_point now)
+{
+    const int count = std::min(property.nnp, PUBLISH_MAX_VALUES);
+    bool changed = false;
+    bool significant = false;
+
+    if (!valid || property.s != state)
+        return true;
+
+    for (int i = 0; i < count; i++)
+    {
+        const double delta = std::fabs(property.np[i].value - values[i]);
+
+        changed = changed || delta > 0;
+        significant = significant || delta > deadband;
+    }
+
+    if (!changed)
+    {
+        // Back to what the clients already have, nothing to send anymore
+        held = heldSignificant = false;
+        return false;
+    }
+
+    const auto elapsed = now - lastSent;
+
+    if ((significant && elapsed >= minInterval) || elapsed >= maxInterval)
+        return true;
+
+    held = true;
+    heldSignificant = significant;
+
+    return false;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusPublisher::due(std::chrono::steady_clock::time_point now) const
+{
+    if (!held)
+        return false;
+
+    const auto elapsed = now - lastSent;
+
+    return (heldSignificant && elapsed >= minInterval) || elapsed >= maxInterval;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusPublisher::sent(const INumberVectorProperty &property, std::chrono::steady_clock::time_point now)
+{
+    const int count = std::min(property.nnp, PUBLISH_MAX_VALUES);
+
+    for (int i = 0; i < count; i++)
+        values[i] = property.np[i].value;
+
+    state = property.s;
+    lastSent = now;
+    valid = true;
+    held = heldSignificant = false;
+}
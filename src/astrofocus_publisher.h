@@ -0,0 +1,68 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_PUBLISHER_H
+
+    #define ASTROFOCUS_PUBLISHER_H
+
+    #include <chrono>
+    #include <cstdint>
+
+    #include <indiapi.h>
+
+    #define PUBLISH_MAX_VALUES  4       // Elements of the largest property that goes through a publisher
+
+    /**
+     * Decides when a polled number property is worth sending to the clients.
+     * A new state always goes out at once. A value that has moved by more
+     * than the deadband goes out, but at most once every minimum interval,
+     * so a burst of polls collapses into one update. Smaller changes wait for
+     * the maximum interval. What is held back goes out later through due(),
+     * always with the latest values.
+     */
+    class AstrofocusPublisher
+    {
+        public:
+            void setLimits(double deadband, uint32_t min_interval_ms, uint32_t max_interval_ms);
+
+            // The next update goes out whatever it carries
+            void reset();
+
+            // The property has new values or state: true if they must be sent now
+            bool update(const INumberVectorProperty &property, std::chrono::steady_clock::time_point now);
+
+            // An update held back can go now
+            bool due(std::chrono::steady_clock::time_point now) const;
+
+            // The property has just been sent
+            void sent(const INumberVectorProperty &property, std::chrono::steady_clock::time_point now);
+
+        private:
+            double deadband { 0 };
+            std::chrono::milliseconds minInterval { 0 };
+            std::chrono::milliseconds maxInterval { 0 };
+
+            bool valid { false };
+            double values[PUBLISH_MAX_VALUES] {};
+            IPState state { IPS_IDLE };
+            std::chrono::steady_clock::time_point lastSent;
+
+            bool held { false };
+            bool heldSignificant { false };     // Held back by the minimum interval, not by the deadband
+    };
+#endif
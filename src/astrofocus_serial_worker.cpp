@@ -0,0 +1,699 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <eventloop.h>
+#include <indiapi.h>
+#include <indicom.h>
+#include <indilogger.h>
+
+#include "astrofocus_serial_worker.h"
+
+// Command code used to file the diagnostics, -1 if the command can't be parsed
+static int commandCode(const char *command)
+{
+    int code = -1, argument = 0;
+
+    return parseCommand(command, &code, &argument) ? code : -1;
+}
+
+/**************************************************************************************
+ ** Constructor
+ ***************************************************************************************/
+AstrofocusSerialWorker::AstrofocusSerialWorker()
+{
+}
+
+/**************************************************************************************
+ ** Distructor
+ ***************************************************************************************/
+AstrofocusSerialWorker::~AstrofocusSerialWorker()
+{
+    stop();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSerialWorker::setDeviceName(const char *name)
+{
+    strncpy(deviceName, name, MESSAGE_MAX_LENGHT - 1);
+}
+
+const char * AstrofocusSerialWorker::getDeviceName() const
+{
+    return deviceName;
+}
+
+/**************************************************************************************
+ ** Thread control
+ ***************************************************************************************/
+bool AstrofocusSerialWorker::start(int fd, CompletionHandler handler, void *context)
+{
+    if (running)
+        return true;
+
+    if (pipe(wakePipe) != 0 || pipe(completionPipe) != 0)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::start => Unable to create pipes: %s", strerror(errno));
+        stop();
+        return false;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        fcntl(wakePipe[i], F_SETFL, fcntl(wakePipe[i], F_GETFL) | O_NONBLOCK);
+        fcntl(completionPipe[i], F_SETFL, fcntl(completionPipe[i], F_GETFL) | O_NONBLOCK);
+    }
+
+    portFD = fd;
+    portError = false;
+    failedBatches = 0;
+    completionHandler = handler;
+    completionContext = context;
+    completionCallbackID = IEAddCallback(completionPipe[0], onCompletionsReady, this);
+
+    running = true;
+    worker = std::thread(&AstrofocusSerialWorker::run, this);
+
+    DEBUG(INDI::Logger::DBG_DEBUG, "AstrofocusSerialWorker::start => Serial worker started");
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSerialWorker::stop()
+{
+    Request request;
+    Completion completion;
+
+    if (running)
+    {
+        running = false;
+
+        if (write(wakePipe[1], "", 1) < 0)
+            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::stop => Unable to wake the worker: %s", strerror(errno));
+    }
+
+    if (worker.joinable())
+        worker.join();
+
+    if (completionCallbackID != -1)
+    {
+        IERmCallback(completionCallbackID);
+        completionCallbackID = -1;
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        if (wakePipe[i] != -1)
+            close(wakePipe[i]);
+
+        if (completionPipe[i] != -1)
+            close(completionPipe[i]);
+
+        wakePipe[i] = completionPipe[i] = -1;
+    }
+
+    // Whatever is still queued belongs to the old connection
+    while (requests.pop(request));
+    while (completions.pop(completion));
+
+    portFD = -1;
+    lineBuffer.clear();
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusSerialWorker::isRunning() const
+{
+    return running;
+}
+
+/**************************************************************************************
+ ** Requests
+ ***************************************************************************************/
+bool AstrofocusSerialWorker::post(RequestType type, int tag, const char *command)
+{
+    Request request;
+
+    if (!running)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::post => Worker not running, %s dropped", command);
+        return false;
+    }
+
+    if (strlen(command) + 1 >= MESSAGE_MAX_LENGHT)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::post => Command too long: %s", command);
+        return false;
+    }
+
+    request.type = type;
+    request.tag = tag;
+    request.following = 0;
+    strcpy(request.command, command);
+
+    if (!requests.push(request))
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::post => Queue full, %s dropped", command);
+        return false;
+    }
+
+    wake();
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusSerialWorker::postGroup(RequestType type, int tag, const char * const cmds[], int count)
+{
+    Request request;
+
+    if (!running)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::postGroup => Worker not running, %d commands dropped", count);
+        return false;
+    }
+
+    if (count <= 0 || count > MAX_BATCH_COMMANDS)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::postGroup => Invalid group size: %d", count);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        if (strlen(cmds[i]) + 1 >= MESSAGE_MAX_LENGHT)
+        {
+            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::postGroup => Command too long: %s", cmds[i]);
+            return false;
+        }
+    }
+
+    // A group cut short would leave the worker waiting for the rest
+    if (requests.available() < (size_t)count)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::postGroup => Queue full, %d commands dropped", count);
+        return false;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        request.type = type;
+        request.tag = tag;
+        request.following = (i == 0) ? count - 1 : 0;
+        strcpy(request.command, cmds[i]);
+
+        requests.push(request);
+    }
+
+    wake();
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Requests posted between holdBatch() and releaseBatch() are handed to the
+ * worker at once. An idle worker then writes them all in the same batch, as
+ * long as they fit, instead of taking off with the first one.
+ */
+void AstrofocusSerialWorker::holdBatch()
+{
+    holdDepth++;
+}
+
+void AstrofocusSerialWorker::releaseBatch()
+{
+    if (holdDepth > 0 && --holdDepth == 0 && wakeHeld)
+    {
+        wakeHeld = false;
+        wake();
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSerialWorker::wake()
+{
+    if (holdDepth > 0)
+    {
+        wakeHeld = true;
+        return;
+    }
+
+    // A full pipe already means the worker has a wake-up pending
+    if (write(wakePipe[1], "", 1) < 0 && errno != EAGAIN)
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::wake => Unable to wake the worker: %s", strerror(errno));
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Error recovery only: drops everything pending on the line, in both
+ * directions. Normal exchanges never flush, so no reply can be lost.
+ */
+void AstrofocusSerialWorker::flush()
+{
+    if (portFD != -1)
+        tcflush(portFD, TCIOFLUSH);
+
+    lineBuffer.clear();
+}
+
+/* ************************************************************************************ */
+
+AstrofocusDiagnostics &AstrofocusSerialWorker::getDiagnostics()
+{
+    return diagnostics;
+}
+
+bool AstrofocusSerialWorker::isLinkDown() const
+{
+    return portError || failedBatches >= LINK_FAILED_BATCHES;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusSerialWorker::startRecording(const char *path)
+{
+    if (running)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::startRecording => The port is owned by the worker thread");
+        return false;
+    }
+
+    if (!recorder.open(path))
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::startRecording => Unable to create %s: %s", path, strerror(errno));
+        return false;
+    }
+
+    DEBUGF(INDI::Logger::DBG_SESSION, "AstrofocusSerialWorker::startRecording => Recording the serial session to %s", path);
+
+    return true;
+}
+
+void AstrofocusSerialWorker::stopRecording()
+{
+    if (running)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::stopRecording => The port is owned by the worker thread");
+        return;
+    }
+
+    recorder.close();
+}
+
+bool AstrofocusSerialWorker::isRecording() const
+{
+    return recorder.isOpen();
+}
+
+/* ************************************************************************************ */
+
+int AstrofocusSerialWorker::transact(int fd, const char * const cmds[], char replies[][MESSAGE_MAX_LENGHT], int count, int timeout)
+{
+    if (running)
+    {
+        DEBUG(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::transact => The port is owned by the worker thread");
+        return -1;
+    }
+
+    if (fd != portFD)
+    {
+        // New connection, nothing from the old one is worth keeping
+        portFD = fd;
+        lineBuffer.clear();
+    }
+
+    return exchange(cmds, replies, count, timeout);
+}
+
+/**************************************************************************************
+ ** Worker thread
+ ***************************************************************************************/
+void AstrofocusSerialWorker::run()
+{
+    Request batch[MAX_BATCH_COMMANDS];
+    Request next;
+    bool has_next = false;
+    char buffer[64];
+
+    while (running)
+    {
+        int count = 0;
+
+        while (has_next || requests.pop(next))
+        {
+            has_next = true;
+
+            // A group that doesn't fit opens the next batch
+            if (count + 1 + next.following > MAX_BATCH_COMMANDS)
+                break;
+
+            const int following = next.following;
+
+            batch[count++] = next;
+            has_next = false;
+
+            // The rest of the group is pushed right behind its head
+            for (int i = 0; i < following && running; i++)
+            {
+                while (running && !requests.pop(batch[count]))
+                    std::this_thread::yield();
+
+                if (running)
+                    count++;
+            }
+        }
+
+        if (!running)
+            break;
+
+        if (count > 0)
+        {
+            processBatch(batch, count);
+            continue;
+        }
+
+        struct pollfd pfd = { wakePipe[0], POLLIN, 0 };
+
+        if (poll(&pfd, 1, -1) > 0)
+            while (read(wakePipe[0], buffer, sizeof(buffer)) > 0);
+    }
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Sends everything that was queued in one write. Identical queries with no
+ * command between them are coalesced, they go out once and share the reply.
+ * A command may change what the query reads, so it starts a new span.
+ */
+void AstrofocusSerialWorker::processBatch(Request batch[], int count)
+{
+    const char *cmds[MAX_BATCH_COMMANDS];
+    char replies[MAX_BATCH_COMMANDS][MESSAGE_MAX_LENGHT];
+    int slots[MAX_BATCH_COMMANDS];
+    int unique = 0, received = 0, span = 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        slots[i] = -1;
+
+        if (batch[i].type == REQUEST_COMMAND)
+            span = i + 1;
+        else
+        {
+            for (int j = span; j < i && slots[i] == -1; j++)
+            {
+                if (!strcmp(batch[j].command, batch[i].command))
+                    slots[i] = slots[j];
+            }
+
+            if (slots[i] != -1)
+                diagnostics.recordCoalesced();
+        }
+
+        if (slots[i] == -1)
+        {
+            slots[i] = unique;
+            cmds[unique++] = batch[i].command;
+        }
+    }
+
+    received = exchange(cmds, replies, unique, READ_TIMEOUT);
+
+    for (int i = 0; i < count; i++)
+    {
+        Completion completion;
+
+        completion.tag = batch[i].tag;
+        strcpy(completion.command, batch[i].command);
+
+        if (slots[i] < received)
+        {
+            strcpy(completion.reply, replies[slots[i]]);
+            completion.success = (batch[i].type == REQUEST_QUERY || isAcknowledged(completion.reply));
+
+            if (!completion.success)
+                diagnostics.recordRejected(commandCode(batch[i].command));
+        }
+        else
+        {
+            completion.reply[0] = '\0';
+            completion.success = false;
+        }
+
+        while (!completions.push(completion) && running)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    if (write(completionPipe[1], "", 1) < 0 && errno != EAGAIN)
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::processBatch => Unable to notify completions: %s", strerror(errno));
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Writes all the commands in a single shot and then reads back the replies
+ * from the connection line buffer, in the same order in which the commands were sent.
+ * The timeout is applied to the whole batch, not to every single command.
+ * A garbled line ends the batch: it may hide one reply or several, so
+ * nothing after it can be paired with its command.
+ * Returns the number of replies received, the missing ones are left empty.
+ */
+int AstrofocusSerialWorker::exchange(const char * const cmds[], char replies[][MESSAGE_MAX_LENGHT], int count, int timeout)
+{
+    int nbytes_written = 0, err_code = 0, cmd_length = 0, received = 0;
+    size_t batch_length = 0;
+    char err_msg[MAXRBUF];
+    char batch[MESSAGE_MAX_LENGHT * MAX_BATCH_COMMANDS];
+    int codes[MAX_BATCH_COMMANDS];
+    std::string_view line;
+    bool garbled = false;
+
+    if (count <= 0 || count > MAX_BATCH_COMMANDS)
+    {
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::exchange => Invalid batch size: %d", count);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++)
+    {
+        replies[i][0] = '\0';
+
+        cmd_length = strlen(cmds[i]);
+
+        if (cmd_length + 1 >= MESSAGE_MAX_LENGHT)
+        {
+            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::exchange => Command too long: %s", cmds[i]);
+            return -1;
+        }
+
+        codes[i] = commandCode(cmds[i]);
+
+        memcpy(batch + batch_length, cmds[i], cmd_length);
+        batch_length += cmd_length;
+        batch[batch_length++] = '\n';
+    }
+
+    // Complete lines still buffered arrived after their batch timed out, they can't answer this one
+    if (int stale = lineBuffer.discardLines())
+    {
+        diagnostics.recordStaleReplies(stale);
+        DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusSerialWorker::exchange => Dropped %d stale replies", stale);
+    }
+
+    const unsigned long dropped_before = lineBuffer.droppedLines();
+
+    if ((err_code = tty_write(portFD, batch, batch_length, &nbytes_written)) != TTY_OK)
+    {
+        tty_error_msg(err_code, err_msg, MAXRBUF);
+
+        DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::exchange => TTY write error detected: %s", err_msg);
+        portError = true;
+        return -1;
+    }
+
+    DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusSerialWorker::exchange => %d commands sent in %d bytes", count, nbytes_written);
+
+    recorder.record(SESSION_TO_DEVICE, batch, nbytes_written);
+
+    const auto sent = std::chrono::steady_clock::now();
+    const auto deadline = sent + std::chrono::seconds(timeout);
+
+    diagnostics.recordBatch(nbytes_written);
+
+    while (received < count && !garbled)
+    {
+        int remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+
+        if (remaining_ms <= 0)
+            break;
+
+        struct pollfd pfd = { portFD, POLLIN, 0 };
+        int rc = poll(&pfd, 1, remaining_ms);
+
+        if (rc < 0)
+        {
+            if (errno == EINTR)
+                continue;
+
+            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::exchange => poll error: %s", strerror(errno));
+            portError = true;
+            break;
+        }
+
+        if (rc == 0)
+            break;
+
+        ssize_t nbytes_read = lineBuffer.fill(portFD);
+
+        if (nbytes_read <= 0)
+        {
+            if (nbytes_read < 0 && (errno == EINTR || errno == EAGAIN))
+                continue;
+
+            // End of file on a tty is a hang-up: the adapter is gone
+            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::exchange => TTY read error detected: %s",
+                   nbytes_read == 0 ? "hang-up" : strerror(errno));
+            portError = true;
+            break;
+        }
+
+        diagnostics.recordBytesIn(nbytes_read);
+        recorder.record(SESSION_FROM_DEVICE, lineBuffer.recent(nbytes_read).data(), nbytes_read);
+
+        // Hand every complete line to the command that is waiting for it
+        while (received < count && lineBuffer.nextLine(line, garbled))
+        {
+            if (garbled)
+            {
+                DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::exchange => Garbled reply to %s, batch abandoned", cmds[received]);
+                break;
+            }
+
+            size_t line_length = std::min(line.size(), (size_t)MESSAGE_MAX_LENGHT - 1);
+
+            memcpy(replies[received], line.data(), line_length);
+            replies[received][line_length] = '\0';
+
+            DEBUGF(INDI::Logger::DBG_DEBUG, "AstrofocusSerialWorker::exchange => %s -> %s", cmds[received], replies[received]);
+
+            diagnostics.recordReply(codes[received],
+                                    std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent).count());
+            received++;
+        }
+    }
+
+    diagnostics.recordDroppedLines(lineBuffer.droppedLines() - dropped_before);
+
+    // A garbled reply still proves the device is there, only total silence counts against the link
+    if (received > 0 || garbled)
+        failedBatches = 0;
+    else
+        failedBatches++;
+
+    if (received < count)
+    {
+        if (!garbled)
+        {
+            DEBUGF(INDI::Logger::DBG_ERROR, "AstrofocusSerialWorker::exchange => Timeout, only %d of %d replies received", received, count);
+
+            for (int i = received; i < count; i++)
+                diagnostics.recordTimeout(codes[i]);
+        }
+
+        // The rest of an abandoned batch is still on its way, it must not answer the next one
+        if (garbled)
+            settle(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count());
+
+        // The replies are matched by position, once one is missing the stream can't be trusted
+        flush();
+        diagnostics.recordResync();
+    }
+
+    return received;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * Reads and throws away whatever the device still sends, until the line
+ * has been silent for LINK_SETTLE_MS or the timeout expires.
+ */
+void AstrofocusSerialWorker::settle(int timeout_ms)
+{
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    char buffer[LINE_BUFFER_SIZE];
+
+    for (;;)
+    {
+        int remaining_ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        struct pollfd pfd = { portFD, POLLIN, 0 };
+
+        if (remaining_ms <= 0 || poll(&pfd, 1, std::min(remaining_ms, LINK_SETTLE_MS)) <= 0)
+            break;
+
+        ssize_t nbytes_read = read(portFD, buffer, sizeof(buffer));
+
+        if (nbytes_read <= 0)
+            break;
+
+        diagnostics.recordBytesIn(nbytes_read);
+        recorder.record(SESSION_FROM_DEVICE, buffer, nbytes_read);
+    }
+}
+
+/**************************************************************************************
+ ** Completions, always dispatched on the INDI thread
+ ***************************************************************************************/
+void AstrofocusSerialWorker::onCompletionsReady(int fd, void *userpointer)
+{
+    char buffer[64];
+
+    while (read(fd, buffer, sizeof(buffer)) > 0);
+
+    static_cast<AstrofocusSerialWorker *>(userpointer)->dispatchCompletions();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSerialWorker::dispatchCompletions()
+{
+    Completion completion;
+
+    while (completions.pop(completion))
+    {
+        if (completionHandler != nullptr)
+            completionHandler(completion, completionContext);
+    }
+}
@@ -0,0 +1,143 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_SERIAL_WORKER_H
+
+    #define ASTROFOCUS_SERIAL_WORKER_H
+
+    #include <atomic>
+    #include <thread>
+
+    #include "astrofocus_diagnostics.h"
+    #include "astrofocus_line_buffer.h"
+    #include "astrofocus_session.h"
+    #include "lockfree_queue.h"
+
+    #define MESSAGE_MAX_LENGHT  50
+    #define READ_TIMEOUT        5
+    #define MAX_BATCH_COMMANDS  16
+    #define SERIAL_QUEUE_SIZE   32
+    #define LINK_FAILED_BATCHES 3       // Batches in a row without a single reply before the link is given up
+    #define LINK_SETTLE_MS      100     // Silence that ends the rest of an abandoned batch
+
+    /**
+     * Owns the serial port once the device is connected.
+     * Requests are posted from the INDI thread through a lock-free queue, the
+     * worker writes everything that is queued in one batch and reads the
+     * replies back in order. Completions are handed back to the INDI event
+     * loop through a pipe, so handlers always run on the INDI thread.
+     */
+    class AstrofocusSerialWorker
+    {
+        public:
+            enum RequestType
+            {
+                REQUEST_QUERY,      // The reply is the payload
+                REQUEST_COMMAND     // The reply must be "OK"
+            };
+
+            struct Request
+            {
+                RequestType type;
+                int tag;
+                int following;      // Requests right behind this one that must go in the same write
+                char command[MESSAGE_MAX_LENGHT];
+            };
+
+            struct Completion
+            {
+                int tag;
+                bool success;
+                char command[MESSAGE_MAX_LENGHT];
+                char reply[MESSAGE_MAX_LENGHT];
+            };
+
+            typedef void (*CompletionHandler)(const Completion &completion, void *context);
+
+            AstrofocusSerialWorker();
+            ~AstrofocusSerialWorker();
+
+            void setDeviceName(const char *name);
+
+            bool start(int fd, CompletionHandler handler, void *context);
+            void stop();
+            bool isRunning() const;
+
+            bool post(RequestType type, int tag, const char *command);
+
+            // All the commands go out in one write, or none is queued. Only from the INDI thread
+            bool postGroup(RequestType type, int tag, const char * const cmds[], int count);
+
+            // Posts in between go to the worker together, so they can share a write. Only from the INDI thread
+            void holdBatch();
+            void releaseBatch();
+
+            // Synchronous batch exchange on fd, only allowed while the worker is stopped
+            int transact(int fd, const char * const cmds[], char replies[][MESSAGE_MAX_LENGHT], int count, int timeout = READ_TIMEOUT);
+
+            // Error recovery, only allowed while the worker is stopped or from the worker itself
+            void flush();
+
+            // Every byte in and out of the port goes to a session file, only allowed while the worker is stopped
+            bool startRecording(const char *path);
+            void stopRecording();
+            bool isRecording() const;
+
+            // Link counters, recorded by the worker and safe to read or reset from any thread
+            AstrofocusDiagnostics &getDiagnostics();
+
+            // The port has failed, or the device stopped answering, since the worker was started
+            bool isLinkDown() const;
+
+        private:
+            void run();
+            void wake();
+            void processBatch(Request batch[], int count);
+            int exchange(const char * const cmds[], char replies[][MESSAGE_MAX_LENGHT], int count, int timeout);
+            void settle(int timeout_ms);
+
+            static void onCompletionsReady(int fd, void *userpointer);
+            void dispatchCompletions();
+
+            const char *getDeviceName() const;
+
+            char deviceName[MESSAGE_MAX_LENGHT] {};
+            int portFD { -1 };
+            AstrofocusLineBuffer lineBuffer;
+            AstrofocusDiagnostics diagnostics;
+            AstrofocusSessionRecorder recorder;
+
+            int wakePipe[2] { -1, -1 };
+            int holdDepth { 0 };
+            bool wakeHeld { false };
+            int completionPipe[2] { -1, -1 };
+            int completionCallbackID { -1 };
+
+            CompletionHandler completionHandler { nullptr };
+            void *completionContext { nullptr };
+
+            LockFreeQueue<Request, SERIAL_QUEUE_SIZE> requests;
+            LockFreeQueue<Completion, SERIAL_QUEUE_SIZE * 2> completions;
+
+            std::thread worker;
+            std::atomic<bool> running { false };
+
+            std::atomic<bool> portError { false };
+            std::atomic<int> failedBatches { 0 };
+    };
+#endif
@@ -0,0 +1,189 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <algorithm>
+#include <cstring>
+
+#include "astrofocus_session.h"
+
+/**************************************************************************************
+ ** Recorder
+ ***************************************************************************************/
+AstrofocusSessionRecorder::~AstrofocusSessionRecorder()
+{
+    close();
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusSessionRecorder::open(const char *path)
+{
+    close();
+
+    if ((file = fopen(path, "wb")) == nullptr)
+        return false;
+
+    // Records are a handful of bytes, they reach the disk in large blocks
+    setvbuf(file, buffer, _IOFBF, SESSION_BUFFER_SIZE);
+
+    if (fwrite(SESSION_MAGIC, 1, SESSION_MAGIC_LENGTH, file) != SESSION_MAGIC_LENGTH)
+    {
+        close();
+        return false;
+    }
+
+    last = std::chrono::steady_clock::now();
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSessionRecorder::close()
+{
+    if (file != nullptr)
+    {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+bool AstrofocusSessionRecorder::isOpen() const
+{
+    return file != nullptr;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSessionRecorder::record(SessionDirection direction, const char *data, size_t length)
+{
+    if (file == nullptr || length == 0)
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    uint32_t delta = (uint32_t)std::min<int64_t>(std::chrono::duration_cast<std::chrono::microseconds>(now - last).count(), UINT32_MAX);
+
+    last = now;
+
+    // A longer chunk is split, the parts after the first one take no time
+    while (length > 0)
+    {
+        const size_t chunk = std::min<size_t>(length, SESSION_RECORD_MAX);
+        unsigned char header[SESSION_RECORD_HEADER];
+
+        header[0] = (unsigned char)direction;
+
+        for (int i = 0; i < 4; i++)
+            header[1 + i] = (unsigned char)(delta >> (8 * i));
+
+        header[5] = (unsigned char)(chunk & 0xff);
+        header[6] = (unsigned char)(chunk >> 8);
+
+        fwrite(header, 1, SESSION_RECORD_HEADER, file);
+        fwrite(data, 1, chunk, file);
+
+        data += chunk;
+        length -= chunk;
+        delta = 0;
+    }
+}
+
+/**************************************************************************************
+ ** Reader
+ ***************************************************************************************/
+AstrofocusSessionReader::~AstrofocusSessionReader()
+{
+    close();
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusSessionReader::open(const char *path)
+{
+    char magic[SESSION_MAGIC_LENGTH];
+
+    close();
+
+    if ((file = fopen(path, "rb")) == nullptr)
+        return false;
+
+    if (fread(magic, 1, SESSION_MAGIC_LENGTH, file) != SESSION_MAGIC_LENGTH || memcmp(magic, SESSION_MAGIC, SESSION_MAGIC_LENGTH) != 0)
+    {
+        close();
+        return false;
+    }
+
+    timeUs = 0;
+    truncated = false;
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSessionReader::close()
+{
+    if (file != nullptr)
+    {
+        fclose(file);
+        file = nullptr;
+    }
+}
+
+bool AstrofocusSessionReader::isTruncated() const
+{
+    return truncated;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusSessionReader::next(Record &record)
+{
+    unsigned char header[SESSION_RECORD_HEADER];
+    size_t header_length;
+    uint32_t delta = 0;
+
+    if (file == nullptr)
+        return false;
+
+    // A clean end of file falls between two records
+    if ((header_length = fread(header, 1, SESSION_RECORD_HEADER, file)) != SESSION_RECORD_HEADER)
+    {
+        truncated = (header_length != 0);
+        return false;
+    }
+
+    for (int i = 0; i < 4; i++)
+        delta |= (uint32_t)header[1 + i] << (8 * i);
+
+    record.direction = (SessionDirection)header[0];
+    record.length = header[5] | (header[6] << 8);
+
+    // The recorder of a killed driver may leave half a record behind
+    if ((record.direction != SESSION_TO_DEVICE && record.direction != SESSION_FROM_DEVICE) || record.length > SESSION_RECORD_MAX ||
+            fread(record.data, 1, record.length, file) != record.length)
+    {
+        truncated = true;
+        return false;
+    }
+
+    timeUs += delta;
+    record.timeUs = timeUs;
+
+    return true;
+}
@@ -0,0 +1,92 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_SESSION_H
+
+    #define ASTROFOCUS_SESSION_H
+
+    #include <chrono>
+    #include <cstddef>
+    #include <cstdint>
+    #include <cstdio>
+
+    #define SESSION_MAGIC           "AFSESS1\n"
+    #define SESSION_MAGIC_LENGTH    8
+    #define SESSION_RECORD_HEADER   7       // Direction, time delta, length
+    #define SESSION_RECORD_MAX      1024    // A read never takes more than the line buffer
+    #define SESSION_BUFFER_SIZE     65536
+
+    enum SessionDirection
+    {
+        SESSION_TO_DEVICE = '>',
+        SESSION_FROM_DEVICE = '<'
+    };
+
+    /**
+     * Serial session file: every chunk of bytes written to, or read from,
+     * the port, as it went through the system call. After the magic, each
+     * record is one byte of direction, the microseconds since the previous
+     * record (uint32, saturated) and the length of the chunk (uint16), both
+     * little endian, then the bytes themselves.
+     */
+    class AstrofocusSessionRecorder
+    {
+        public:
+            ~AstrofocusSessionRecorder();
+
+            bool open(const char *path);
+            void close();
+            bool isOpen() const;
+
+            // Not thread safe: only the owner of the port may record
+            void record(SessionDirection direction, const char *data, size_t length);
+
+        private:
+            FILE *file { nullptr };
+            char buffer[SESSION_BUFFER_SIZE];
+            std::chrono::steady_clock::time_point last;
+    };
+
+    /* ************************************************************************************ */
+
+    class AstrofocusSessionReader
+    {
+        public:
+            struct Record
+            {
+                SessionDirection direction;
+                uint64_t timeUs;        // Since the start of the session
+                size_t length;
+                char data[SESSION_RECORD_MAX];
+            };
+
+            ~AstrofocusSessionReader();
+
+            bool open(const char *path);
+            void close();
+
+            // False at the end of the file, or on a truncated record (see isTruncated())
+            bool next(Record &record);
+            bool isTruncated() const;
+
+        private:
+            FILE *file { nullptr };
+            uint64_t timeUs { 0 };
+            bool truncated { false };
+    };
+#endif
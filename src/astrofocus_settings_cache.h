@@ -0,0 +1,116 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_SETTINGS_CACHE_H
+
+    #define ASTROFOCUS_SETTINGS_CACHE_H
+
+    #include "astrofocus_protocol.h"
+
+    /**
+     * Last known device state, keyed by command code.
+     * Every entry has a dirty bit, set on change and cleared once the value
+     * has been published. The cache is only dropped on disconnect, so a full
+     * reload is only needed after a reconnect or when asked for.
+     */
+    class AstrofocusSettingsCache
+    {
+        public:
+            void invalidate()
+            {
+                for (int i = 0; i < COMMAND_COUNT; i++)
+                    entries[i] = Entry();
+
+                loaded = false;
+            }
+
+            void markLoaded()
+            {
+                loaded = true;
+            }
+
+            bool isLoaded() const
+            {
+                return loaded;
+            }
+
+            bool get(int command, int *value) const
+            {
+                if (command < 0 || command >= COMMAND_COUNT || !entries[command].valid)
+                    return false;
+
+                *value = entries[command].value;
+
+                return true;
+            }
+
+            int valueOr(int command, int fallback) const
+            {
+                int value;
+
+                return get(command, &value) ? value : fallback;
+            }
+
+            // Returns true if the value has changed
+            bool set(int command, int value)
+            {
+                if (command < 0 || command >= COMMAND_COUNT)
+                    return false;
+
+                Entry &entry = entries[command];
+
+                if (entry.valid && entry.value == value)
+                    return false;
+
+                entry.value = value;
+                entry.valid = true;
+                entry.dirty = true;
+
+                return true;
+            }
+
+            bool isDirty(int command) const
+            {
+                return command >= 0 && command < COMMAND_COUNT && entries[command].dirty;
+            }
+
+            // Publishes the cached value again, e.g. over a value a client has set but the device refused
+            void markDirty(int command)
+            {
+                if (command >= 0 && command < COMMAND_COUNT && entries[command].valid)
+                    entries[command].dirty = true;
+            }
+
+            void clearDirty(int command)
+            {
+                if (command >= 0 && command < COMMAND_COUNT)
+                    entries[command].dirty = false;
+            }
+
+        private:
+            struct Entry
+            {
+                int value { 0 };
+                bool valid { false };
+                bool dirty { false };
+            };
+
+            Entry entries[COMMAND_COUNT];
+            bool loaded { false };
+    };
+#endif
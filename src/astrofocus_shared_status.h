@@ -0,0 +1,197 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_SHARED_STATUS_H
+
+    #define ASTROFOCUS_SHARED_STATUS_H
+
+    #include <atomic>
+    #include <cstdint>
+    #include <cstdio>
+    #include <ctime>
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+    #define SHARED_STATUS_MAGIC     0x53464641u     // "AFFS"
+    #define SHARED_STATUS_VERSION   1
+    #define SHARED_STATUS_NAME_MAX  64
+    #define SHARED_STATUS_RETRIES   64              // Torn reads in a row before a reader gives up
+
+    #define SHARED_STATUS_MOVING                (1u << 0)
+    #define SHARED_STATUS_TEMPERATURE_VALID     (1u << 1)
+    #define SHARED_STATUS_CONNECTED             (1u << 2)
+
+    /**
+     * Status of one focuser, published by the driver in POSIX shared memory
+     * for the clients on the same host. Header only and without INDI
+     * dependencies, so that clients can include it as it is.
+     *
+     * The driver is the only writer. The sequence is odd while it writes,
+     * a reader retries when the sequence is odd or changed under it. Every
+     * field is an atomic, so a torn read is detected and never undefined.
+     */
+    struct alignas(64) AstrofocusSharedStatus
+    {
+        uint32_t magic;
+        uint32_t version;
+        std::atomic<uint32_t> sequence;
+        std::atomic<uint32_t> flags;
+        std::atomic<int32_t> position;
+        std::atomic<int32_t> target;
+        std::atomic<double> temperature;
+        std::atomic<int64_t> updated_ns;    // CLOCK_MONOTONIC of the last update, comparable between processes of the host
+
+        // Plain copy of the fields, as read by the clients
+        struct Values
+        {
+            uint32_t flags;
+            int32_t position;
+            int32_t target;
+            double temperature;
+            int64_t updated_ns;
+        };
+    };
+
+    static_assert(sizeof(AstrofocusSharedStatus) == 64, "The status must fill exactly one cache line");
+    static_assert(std::atomic<double>::is_always_lock_free && std::atomic<int64_t>::is_always_lock_free,
+                  "Shared memory atomics must be lock free");
+
+    // "/astrofocus-<device>", every character that is not alphanumeric becomes '_'
+    inline void astrofocusSharedStatusName(const char *device, char name[SHARED_STATUS_NAME_MAX])
+    {
+        int length = snprintf(name, SHARED_STATUS_NAME_MAX, "/astrofocus-%s", device);
+
+        if (length >= SHARED_STATUS_NAME_MAX)
+            length = SHARED_STATUS_NAME_MAX - 1;
+
+        for (int i = 1; i < length; i++)
+        {
+            const char c = name[i];
+
+            if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '-'))
+                name[i] = '_';
+        }
+    }
+
+    inline int64_t astrofocusMonotonicNs()
+    {
+        timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    }
+
+    /**
+     * Maps the status of a focuser read only. Reads never block and never
+     * call into the kernel, they can run at any rate.
+     */
+    class AstrofocusSharedStatusReader
+    {
+        public:
+            AstrofocusSharedStatusReader() = default;
+            AstrofocusSharedStatusReader(const AstrofocusSharedStatusReader &) = delete;
+            AstrofocusSharedStatusReader &operator=(const AstrofocusSharedStatusReader &) = delete;
+
+            ~AstrofocusSharedStatusReader()
+            {
+                close();
+            }
+
+            // The device name as shown by INDI, the driver must have the shared status on
+            bool open(const char *device)
+            {
+                char name[SHARED_STATUS_NAME_MAX];
+
+                close();
+                astrofocusSharedStatusName(device, name);
+
+                int fd = shm_open(name, O_RDONLY, 0);
+
+                if (fd < 0)
+                    return false;
+
+                struct stat info;
+                void *memory = MAP_FAILED;
+
+                if (fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(AstrofocusSharedStatus))
+                    memory = mmap(nullptr, sizeof(AstrofocusSharedStatus), PROT_READ, MAP_SHARED, fd, 0);
+
+                ::close(fd);
+
+                if (memory == MAP_FAILED)
+                    return false;
+
+                status = static_cast<const AstrofocusSharedStatus *>(memory);
+
+                if (status->magic != SHARED_STATUS_MAGIC || status->version != SHARED_STATUS_VERSION)
+                {
+                    close();
+                    return false;
+                }
+
+                return true;
+            }
+
+            void close()
+            {
+                if (status != nullptr)
+                    munmap(const_cast<AstrofocusSharedStatus *>(status), sizeof(AstrofocusSharedStatus));
+
+                status = nullptr;
+            }
+
+            bool isOpen() const
+            {
+                return status != nullptr;
+            }
+
+            // False only if the driver kept writing through every retry
+            bool read(AstrofocusSharedStatus::Values &values) const
+            {
+                if (status == nullptr)
+                    return false;
+
+                for (int i = 0; i < SHARED_STATUS_RETRIES; i++)
+                {
+                    const uint32_t before = status->sequence.load(std::memory_order_acquire);
+
+                    if (before & 1)
+                        continue;
+
+                    values.flags = status->flags.load(std::memory_order_relaxed);
+                    values.position = status->position.load(std::memory_order_relaxed);
+                    values.target = status->target.load(std::memory_order_relaxed);
+                    values.temperature = status->temperature.load(std::memory_order_relaxed);
+                    values.updated_ns = status->updated_ns.load(std::memory_order_relaxed);
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+
+                    if (status->sequence.load(std::memory_order_relaxed) == before)
+                        return true;
+                }
+
+                return false;
+            }
+
+        private:
+            const AstrofocusSharedStatus *status { nullptr };
+    };
+#endif
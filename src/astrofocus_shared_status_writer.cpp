@@ -0,0 +1,129 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <new>
+
+#include "astrofocus_shared_status_writer.h"
+
+AstrofocusSharedStatusWriter::~AstrofocusSharedStatusWriter()
+{
+    close();
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusSharedStatusWriter::open(const char *device)
+{
+    close();
+    astrofocusSharedStatusName(device, regionName);
+
+    // Readable by everyone on the host, only the driver writes
+    int fd = shm_open(regionName, O_RDWR | O_CREAT, 0644);
+
+    if (fd < 0)
+        return false;
+
+    void *memory = MAP_FAILED;
+
+    if (ftruncate(fd, sizeof(AstrofocusSharedStatus)) == 0)
+        memory = mmap(nullptr, sizeof(AstrofocusSharedStatus), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    ::close(fd);
+
+    if (memory == MAP_FAILED)
+    {
+        shm_unlink(regionName);
+        return false;
+    }
+
+    // Default initialised, a left over sequence is not touched until the store below
+    status = new (memory) AstrofocusSharedStatus;
+
+    // A region left over by a crashed driver may still be mapped: readers must not trust it while it is rewritten
+    status->sequence.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    status->magic = SHARED_STATUS_MAGIC;
+    status->version = SHARED_STATUS_VERSION;
+    status->flags.store(0, std::memory_order_relaxed);
+    status->position.store(0, std::memory_order_relaxed);
+    status->target.store(0, std::memory_order_relaxed);
+    status->temperature.store(0, std::memory_order_relaxed);
+    status->updated_ns.store(astrofocusMonotonicNs(), std::memory_order_relaxed);
+
+    status->sequence.store(2, std::memory_order_release);
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+/**
+ * The last values stay in the region for the readers that still have it
+ * mapped, without the connected flag. The name goes away, so new readers
+ * only find the region of a running driver.
+ */
+void AstrofocusSharedStatusWriter::close()
+{
+    if (status == nullptr)
+        return;
+
+    const uint32_t sequence = status->sequence.load(std::memory_order_relaxed);
+
+    status->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    status->flags.fetch_and(~SHARED_STATUS_CONNECTED, std::memory_order_relaxed);
+    status->sequence.store(sequence + 2, std::memory_order_release);
+
+    munmap(status, sizeof(AstrofocusSharedStatus));
+    shm_unlink(regionName);
+
+    status = nullptr;
+}
+
+bool AstrofocusSharedStatusWriter::isOpen() const
+{
+    return status != nullptr;
+}
+
+const char *AstrofocusSharedStatusWriter::name() const
+{
+    return regionName;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSharedStatusWriter::publish(uint32_t flags, int32_t position, int32_t target, double temperature)
+{
+    if (status == nullptr)
+        return;
+
+    const uint32_t sequence = status->sequence.load(std::memory_order_relaxed);
+
+    // Odd while writing, the fence keeps the field stores behind the odd sequence
+    status->sequence.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    status->flags.store(flags, std::memory_order_relaxed);
+    status->position.store(position, std::memory_order_relaxed);
+    status->target.store(target, std::memory_order_relaxed);
+    status->temperature.store(temperature, std::memory_order_relaxed);
+    status->updated_ns.store(astrofocusMonotonicNs(), std::memory_order_relaxed);
+
+    status->sequence.store(sequence + 2, std::memory_order_release);
+}
@@ -0,0 +1,46 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_SHARED_STATUS_WRITER_H
+
+    #define ASTROFOCUS_SHARED_STATUS_WRITER_H
+
+    #include "astrofocus_shared_status.h"
+
+    /**
+     * Driver side of the shared status: creates the region, publishes the
+     * values and removes the region again. Only one thread may publish.
+     */
+    class AstrofocusSharedStatusWriter
+    {
+        public:
+            ~AstrofocusSharedStatusWriter();
+
+            bool open(const char *device);
+            void close();
+            bool isOpen() const;
+            const char *name() const;
+
+            // Stamped with the current time, readers never see half of an update
+            void publish(uint32_t flags, int32_t position, int32_t target, double temperature);
+
+        private:
+            AstrofocusSharedStatus *status { nullptr };
+            char regionName[SHARED_STATUS_NAME_MAX] {};
+    };
+#endif
@@ -0,0 +1,185 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <cstdio>
+#include <cstring>
+
+#include "astrofocus_snapshot.h"
+
+// Only the settings, commands like GOTO have no state to keep
+static const int snapshotCommands[] =
+{
+    COMMAND_POSITION, COMMAND_UPPER_LIMIT, COMMAND_TEMPERATURE, COMMAND_TEMPERATURE_COEFFICIENT, COMMAND_STEP_SIZE,
+    COMMAND_STEPPER_POWER, COMMAND_PULSES_DURATION, COMMAND_PAUSE, COMMAND_MOTION_MODE
+};
+
+/* ************************************************************************************ */
+
+// A value the device could have reported, anything else comes from a damaged or edited file
+static bool isValidEntry(int command, int value)
+{
+    switch (command)
+    {
+        case COMMAND_POSITION:
+            return isValidCommand(COMMAND_GOTO, value);
+        case COMMAND_TEMPERATURE:
+            return value == 0 || value == 1;
+        case COMMAND_MOTION_MODE:
+            return value != 0 && isValidCommand(command, value);
+        default:
+            // 0 is the query of these settings, and a value they can hold
+            return isValidCommand(command, value);
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSnapshot::capture(const AstrofocusSettingsCache &cache, const char *firmware)
+{
+    clear();
+
+    for (int command : snapshotCommands)
+        known[command] = cache.get(command, &values[command]);
+
+    snprintf(firmwareVersion, SNAPSHOT_FIRMWARE_LENGTH, "%s", firmware);
+    valid = true;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSnapshot::restore(AstrofocusSettingsCache &cache) const
+{
+    for (int command : snapshotCommands)
+    {
+        if (known[command])
+            cache.set(command, values[command]);
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusSnapshot::clear()
+{
+    *this = AstrofocusSnapshot();
+}
+
+bool AstrofocusSnapshot::isValid() const
+{
+    return valid;
+}
+
+const char *AstrofocusSnapshot::firmware() const
+{
+    return firmwareVersion;
+}
+
+bool AstrofocusSnapshot::get(int command, int *value) const
+{
+    if (command < 0 || command >= COMMAND_COUNT || !known[command])
+        return false;
+
+    *value = values[command];
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusSnapshot::load(const char *path)
+{
+    char line[128];
+    bool damaged = false;
+    FILE *fp = fopen(path, "r");
+
+    clear();
+
+    if (fp == nullptr)
+        return false;
+
+    while (fgets(line, sizeof(line), fp) != nullptr)
+    {
+        char *separator = strchr(line, '=');
+
+        if (separator == nullptr)
+            continue;
+
+        *separator = '\0';
+
+        const char *name = line;
+        std::string_view value = trimReply(separator + 1);
+
+        if (!strcmp(name, "FIRMWARE"))
+        {
+            snprintf(firmwareVersion, SNAPSHOT_FIRMWARE_LENGTH, "%.*s", (int)value.size(), value.data());
+            continue;
+        }
+
+        for (int command : snapshotCommands)
+        {
+            if (strcmp(name, commandName(command)))
+                continue;
+
+            Expected<int> parsed = parseInt(value);
+
+            if (!parsed || !isValidEntry(command, parsed.value))
+            {
+                damaged = true;
+                break;
+            }
+
+            values[command] = parsed.value;
+            known[command] = true;
+        }
+    }
+
+    fclose(fp);
+
+    // Without the firmware version there is nothing to check the snapshot against, one bad value and none can be trusted
+    if (damaged || firmwareVersion[0] == '\0')
+    {
+        clear();
+        return false;
+    }
+
+    valid = true;
+
+    return valid;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusSnapshot::save(const char *path) const
+{
+    if (!valid)
+        return false;
+
+    FILE *fp = fopen(path, "w");
+
+    if (fp == nullptr)
+        return false;
+
+    fprintf(fp, "FIRMWARE=%s\n", firmwareVersion);
+
+    for (int command : snapshotCommands)
+    {
+        if (known[command])
+            fprintf(fp, "%s=%d\n", commandName(command), values[command]);
+    }
+
+    return fclose(fp) == 0;
+}
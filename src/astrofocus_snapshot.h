@@ -0,0 +1,54 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_SNAPSHOT_H
+
+    #define ASTROFOCUS_SNAPSHOT_H
+
+    #include "astrofocus_settings_cache.h"
+
+    #define SNAPSHOT_FIRMWARE_LENGTH    50
+
+    /**
+     * The device state as it was last seen: firmware version and settings.
+     * Saved next to the INDI configuration, so that a reconnect, or a new
+     * session, can trust it after a couple of cheap checks instead of
+     * reading every setting back from the firmware.
+     */
+    class AstrofocusSnapshot
+    {
+        public:
+            void capture(const AstrofocusSettingsCache &cache, const char *firmware);
+            void restore(AstrofocusSettingsCache &cache) const;
+            void clear();
+
+            bool isValid() const;
+            const char *firmware() const;
+            bool get(int command, int *value) const;
+
+            // Plain "NAME=value" lines, the names are the ones of commandName()
+            bool load(const char *path);
+            bool save(const char *path) const;
+
+        private:
+            bool valid { false };
+            char firmwareVersion[SNAPSHOT_FIRMWARE_LENGTH] {};
+            int values[COMMAND_COUNT] {};
+            bool known[COMMAND_COUNT] {};
+    };
+#endif
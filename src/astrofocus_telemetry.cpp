@@ -0,0 +1,84 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <cmath>
+#include <cstdio>
+#include <cinttypes>
+
+#include <indidevapi.h>
+
+#include "astrofocus_telemetry.h"
+
+/* ************************************************************************************ */
+
+void AstrofocusTelemetry::clear()
+{
+    recorded = exported = 0;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusTelemetry::add(const Sample &sample)
+{
+    samples[recorded % TELEMETRY_CAPACITY] = sample;
+    recorded++;
+}
+
+/* ************************************************************************************ */
+
+uint64_t AstrofocusTelemetry::pending() const
+{
+    return recorded - exported;
+}
+
+/* ************************************************************************************ */
+
+const char *AstrofocusTelemetry::exportCsv(size_t *size, uint64_t *lost)
+{
+    size_t length = 0;
+
+    *lost = 0;
+
+    // The ring has gone round since the last export, the oldest samples are gone
+    if (recorded - exported > TELEMETRY_CAPACITY)
+    {
+        *lost = recorded - exported - TELEMETRY_CAPACITY;
+        exported += *lost;
+    }
+
+    if (exported == recorded)
+        return nullptr;
+
+    length += snprintf(buffer, sizeof(buffer), "time_ms,position,target,temperature,state,latency_ms\n");
+
+    for (int i = 0; i < TELEMETRY_EXPORT_MAX && exported < recorded; i++, exported++)
+    {
+        const Sample &sample = samples[exported % TELEMETRY_CAPACITY];
+        char temperature[16] = "";
+
+        if (!std::isnan(sample.temperature))
+            snprintf(temperature, sizeof(temperature), "%.2f", sample.temperature);
+
+        length += snprintf(buffer + length, sizeof(buffer) - length, "%" PRId64 ",%d,%d,%s,%s,%u\n", sample.timeMs, sample.position,
+                           sample.target, temperature, pstateStr((IPState)sample.state), sample.latencyMs);
+    }
+
+    *size = length;
+
+    return buffer;
+}
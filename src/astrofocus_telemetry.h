@@ -0,0 +1,71 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_TELEMETRY_H
+
+    #define ASTROFOCUS_TELEMETRY_H
+
+    #include <cstddef>
+    #include <cstdint>
+
+    #define TELEMETRY_CAPACITY      16384   // Samples kept, a whole night at the idle sampling rate
+    #define TELEMETRY_IDLE_MS       10000   // A focuser standing still is sampled this often, or when something changes
+    #define TELEMETRY_EXPORT_MAX    2048    // Samples in one export, the older ones go first
+    #define TELEMETRY_LINE_MAX      80
+
+    /**
+     * History of the focuser, to tell focus drift from temperature over a
+     * whole session. The samples live in a fixed ring, the oldest ones are
+     * overwritten, so memory never grows and nothing is allocated after
+     * construction. Exports are incremental: each one carries the samples
+     * recorded since the previous export, as CSV.
+     */
+    class AstrofocusTelemetry
+    {
+        public:
+            struct Sample
+            {
+                int64_t timeMs;         // Wall clock, ms since the epoch
+                int32_t position;
+                int32_t target;
+                float temperature;      // NaN without a sensor
+                uint16_t latencyMs;     // Of the position query
+                uint8_t state;          // IPState of the absolute position
+            };
+
+            void clear();
+            void add(const Sample &sample);
+
+            // Samples recorded but not exported yet, the ones already overwritten included
+            uint64_t pending() const;
+
+            /**
+             * Formats the next samples to export, at most TELEMETRY_EXPORT_MAX.
+             * Returns nullptr when there is nothing new. Samples overwritten
+             * before they could be exported are counted in lost.
+             */
+            const char *exportCsv(size_t *size, uint64_t *lost);
+
+        private:
+            Sample samples[TELEMETRY_CAPACITY];
+            uint64_t recorded { 0 };    // Samples ever added, the next one goes to recorded % capacity
+            uint64_t exported { 0 };    // Samples ever exported or lost
+
+            char buffer[TELEMETRY_EXPORT_MAX * TELEMETRY_LINE_MAX + TELEMETRY_LINE_MAX];
+    };
+#endif
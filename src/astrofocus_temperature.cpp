@@ -0,0 +1,98 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <algorithm>
+
+#include "astrofocus_temperature.h"
+
+/* ************************************************************************************ */
+
+void AstrofocusTemperatureFilter::reset()
+{
+    count = 0;
+    next = 0;
+    smoothed = 0;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusTemperatureFilter::add(double celsius, double seconds)
+{
+    double recent[TEMPERATURE_MEDIAN];
+    int recent_count;
+
+    samples[next] = celsius;
+    times[next] = seconds;
+    next = (next + 1) % TEMPERATURE_WINDOW;
+
+    if (count < TEMPERATURE_WINDOW)
+        count++;
+
+    recent_count = std::min(count, TEMPERATURE_MEDIAN);
+
+    for (int i = 0; i < recent_count; i++)
+        recent[i] = samples[(next - 1 - i + TEMPERATURE_WINDOW) % TEMPERATURE_WINDOW];
+
+    std::nth_element(recent, recent + recent_count / 2, recent + recent_count);
+
+    if (count == 1)
+        smoothed = recent[0];
+    else
+        smoothed += TEMPERATURE_EMA_ALPHA * (recent[recent_count / 2] - smoothed);
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusTemperatureFilter::ready() const
+{
+    return count >= TEMPERATURE_MEDIAN;
+}
+
+/* ************************************************************************************ */
+
+double AstrofocusTemperatureFilter::value() const
+{
+    return smoothed;
+}
+
+/* ************************************************************************************ */
+
+double AstrofocusTemperatureFilter::slope() const
+{
+    double mean_t = 0, mean_y = 0, covariance = 0, variance = 0;
+
+    if (count < TEMPERATURE_MEDIAN)
+        return 0;
+
+    for (int i = 0; i < count; i++)
+    {
+        mean_t += times[i];
+        mean_y += samples[i];
+    }
+
+    mean_t /= count;
+    mean_y /= count;
+
+    for (int i = 0; i < count; i++)
+    {
+        covariance += (times[i] - mean_t) * (samples[i] - mean_y);
+        variance += (times[i] - mean_t) * (times[i] - mean_t);
+    }
+
+    return variance > 0 ? covariance / variance : 0;
+}
@@ -0,0 +1,54 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_TEMPERATURE_H
+
+    #define ASTROFOCUS_TEMPERATURE_H
+
+    #define TEMPERATURE_WINDOW      16      // Readings kept for the median and the trend
+    #define TEMPERATURE_MEDIAN      5       // Readings used by the median (spike rejection)
+    #define TEMPERATURE_EMA_ALPHA   0.2     // Weight of a new reading in the smoothed value
+
+    /**
+     * Smooths the raw sensor readings: a short median rejects the spikes,
+     * an exponential moving average removes the noise. The trend is the
+     * least squares slope over the whole window.
+     */
+    class AstrofocusTemperatureFilter
+    {
+        public:
+            void reset();
+
+            // Adds a reading taken at the given time, in seconds from any fixed origin
+            void add(double celsius, double seconds);
+
+            bool ready() const;
+            double value() const;
+
+            // Degrees per second, 0 until enough readings are available
+            double slope() const;
+
+        private:
+            double samples[TEMPERATURE_WINDOW] {};
+            double times[TEMPERATURE_WINDOW] {};
+            int count { 0 };
+            int next { 0 };
+
+            double smoothed { 0 };
+    };
+#endif
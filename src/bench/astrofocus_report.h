@@ -0,0 +1,75 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_REPORT_H
+
+    #define ASTROFOCUS_REPORT_H
+
+    #include <algorithm>
+    #include <cstdio>
+    #include <fcntl.h>
+    #include <unistd.h>
+    #include <vector>
+
+    /**
+     * Shared by the tools that run the driver in process and print a JSON
+     * report: bench_astrofocus and replay_astrofocus.
+     */
+    struct LatencyStats
+    {
+        std::vector<double> samples;    // Milliseconds
+        int lost { 0 };
+
+        double percentile(double p) const
+        {
+            if (samples.empty())
+                return 0;
+
+            std::vector<double> sorted(samples);
+            std::sort(sorted.begin(), sorted.end());
+
+            return sorted[std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5))];
+        }
+
+        double max() const
+        {
+            return samples.empty() ? 0 : *std::max_element(samples.begin(), samples.end());
+        }
+    };
+
+    // The report goes to the file, or to what stdout is before muteStdout()
+    inline FILE *openReport(const char *path)
+    {
+        return path != nullptr ? fopen(path, "w") : fdopen(dup(STDOUT_FILENO), "w");
+    }
+
+    // The driver speaks INDI XML on stdout, it must not be mixed with the report
+    inline bool muteStdout()
+    {
+        const int null_fd = open("/dev/null", O_WRONLY);
+
+        if (null_fd == -1)
+            return false;
+
+        fflush(stdout);
+        dup2(null_fd, STDOUT_FILENO);
+        close(null_fd);
+
+        return true;
+    }
+#endif
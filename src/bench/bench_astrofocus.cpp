@@ -0,0 +1,371 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <unistd.h>
+
+#include <eventloop.h>
+#include <indicom.h>
+
+#include "../astrofocus_focuser.h"
+#include "../simulator/astrofocus_emulator.h"
+#include "astrofocus_report.h"
+
+#define BENCH_TIMEOUT_MS    2000    // A request that takes longer than this is counted as lost
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Drives a real AstrofocusFocuser against the firmware emulator. The serial
+ * worker is started without the INDI poll timer, so every exchange measured
+ * here is one the bench asked for, and it completes through the same
+ * handler the driver uses.
+ */
+class AstrofocusBench
+{
+    public:
+        bool connect(const char *port);
+        void disconnect();
+
+        LatencyStats benchConnect(int iterations);
+        LatencyStats benchPositionQuery(int iterations);
+        LatencyStats benchMove(int iterations);
+        LatencyStats benchSettingsWrite(int iterations);
+        double benchPollThroughput(double seconds);
+
+    private:
+        static void onCompletion(const AstrofocusSerialWorker::Completion &completion, void *context);
+        bool postAndWait(int tag, AstrofocusSerialWorker::RequestType type, const char *command, double *latency_ms);
+        bool waitFor(int tag, double *latency_ms);
+
+        AstrofocusFocuser focuser;
+
+        int waitingTag { -1 };
+        int completed { 0 };
+        Clock::time_point started;
+        Clock::time_point finished;
+};
+
+/* ************************************************************************************ */
+
+bool AstrofocusBench::connect(const char *port)
+{
+    focuser.initProperties();
+
+    if (tty_connect(port, 9600, 8, 0, 1, &focuser.PortFD) != TTY_OK)
+    {
+        fprintf(stderr, "bench_astrofocus: unable to open %s\n", port);
+        return false;
+    }
+
+    return focuser.Handshake();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusBench::disconnect()
+{
+    focuser.serialWorker.stop();
+    tty_disconnect(focuser.PortFD);
+    focuser.PortFD = -1;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusBench::onCompletion(const AstrofocusSerialWorker::Completion &completion, void *context)
+{
+    AstrofocusBench *bench = static_cast<AstrofocusBench *>(context);
+
+    if (completion.tag == bench->waitingTag)
+    {
+        bench->finished = Clock::now();
+        bench->completed = 1;
+    }
+
+    bench->focuser.handleCompletion(completion);
+
+    // Idle polls would interleave with the measured requests, only moves keep their poll chain
+    if (!bench->focuser.moveInProgress && bench->focuser.pollTimerID != -1)
+    {
+        bench->focuser.RemoveTimer(bench->focuser.pollTimerID);
+        bench->focuser.pollTimerID = -1;
+    }
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusBench::waitFor(int tag, double *latency_ms)
+{
+    waitingTag = tag;
+
+    const bool done = IEDeferLoop(BENCH_TIMEOUT_MS, &completed) == 0;
+
+    waitingTag = -1;
+    completed = 0;
+
+    if (done && latency_ms != nullptr)
+        *latency_ms = std::chrono::duration<double, std::milli>(finished - started).count();
+
+    return done;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusBench::postAndWait(int tag, AstrofocusSerialWorker::RequestType type, const char *command, double *latency_ms)
+{
+    started = Clock::now();
+
+    if (!focuser.serialWorker.post(type, tag, command))
+        return false;
+
+    return waitFor(tag, latency_ms);
+}
+
+/**************************************************************************************
+ ** Benchmarks
+ ***************************************************************************************/
+LatencyStats AstrofocusBench::benchConnect(int iterations)
+{
+    LatencyStats stats;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        const auto start = Clock::now();
+
+        if (!focuser.Handshake())
+        {
+            stats.lost++;
+            continue;
+        }
+
+        focuser.loadSettingsFromDevice();
+        stats.samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    }
+
+    // From now on the port belongs to the worker, as after a real connection
+    focuser.setConnected(true);
+    focuser.serialWorker.start(focuser.PortFD, &AstrofocusBench::onCompletion, this);
+
+    return stats;
+}
+
+/* ************************************************************************************ */
+
+LatencyStats AstrofocusBench::benchPositionQuery(int iterations)
+{
+    LatencyStats stats;
+    double latency_ms = 0;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        focuser.positionQueryPending = true;
+
+        if (postAndWait(AstrofocusFocuser::SERIAL_TAG_POSITION, AstrofocusSerialWorker::REQUEST_QUERY, commandText<COMMAND_POSITION, 0>(), &latency_ms))
+            stats.samples.push_back(latency_ms);
+        else
+            stats.lost++;
+    }
+
+    return stats;
+}
+
+/* ************************************************************************************ */
+
+LatencyStats AstrofocusBench::benchMove(int iterations)
+{
+    LatencyStats stats;
+    double latency_ms = 0;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        // Short moves back and forth, the latency is the time to the firmware ack
+        const uint32_t target = focuser.lastPosition + ((i % 2) ? -10 : 10);
+
+        started = Clock::now();
+
+        if (focuser.MoveAbsFocuser(target) != IPS_BUSY || !waitFor(AstrofocusFocuser::SERIAL_TAG_MOVE, &latency_ms))
+        {
+            stats.lost++;
+            continue;
+        }
+
+        stats.samples.push_back(latency_ms);
+
+        // The poll chain brings the move to an end before the next one starts
+        const auto deadline = Clock::now() + std::chrono::milliseconds(BENCH_TIMEOUT_MS);
+        int never = 0;
+
+        while (focuser.moveInProgress && Clock::now() < deadline)
+            IEDeferLoop(POLL_MIN_MS, &never);
+    }
+
+    return stats;
+}
+
+/* ************************************************************************************ */
+
+LatencyStats AstrofocusBench::benchSettingsWrite(int iterations)
+{
+    LatencyStats stats;
+    double latency_ms = 0;
+
+    for (int i = 0; i < iterations; i++)
+    {
+        // Goes through the same property the clients write, 0 would be read back as a query
+        double value = 1 + i % 2;
+        char *names[] = { focuser.TemperatureCoefficientN[0].name };
+
+        started = Clock::now();
+
+        if (!focuser.ISNewNumber(focuser.getDeviceName(), focuser.TemperatureCoefficientNP.name, &value, names, 1) ||
+                !waitFor(AstrofocusFocuser::SERIAL_TAG_SETTINGS_WRITE, &latency_ms))
+        {
+            stats.lost++;
+            continue;
+        }
+
+        stats.samples.push_back(latency_ms);
+    }
+
+    return stats;
+}
+
+/* ************************************************************************************ */
+
+double AstrofocusBench::benchPollThroughput(double seconds)
+{
+    // One query in flight at any time, as the driver does while a move is running
+    const auto start = Clock::now();
+    const auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+    int polls = 0;
+
+    while (Clock::now() < end)
+    {
+        focuser.positionQueryPending = true;
+
+        if (postAndWait(AstrofocusFocuser::SERIAL_TAG_POSITION, AstrofocusSerialWorker::REQUEST_QUERY, commandText<COMMAND_POSITION, 0>(), nullptr))
+            polls++;
+    }
+
+    return polls / std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/**************************************************************************************
+ ** Report
+ ***************************************************************************************/
+static void printStats(FILE *out, const char *name, const LatencyStats &stats, bool last)
+{
+    fprintf(out, "    \"%s\": { \"samples\": %zu, \"lost\": %d, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f }%s\n",
+            name, stats.samples.size(), stats.lost, stats.percentile(0.5), stats.percentile(0.99), stats.max(), last ? "" : ",");
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --iterations N        samples for every latency benchmark (default 100)\n"
+            "  --duration S          seconds of sustained position polling (default 3)\n"
+            "  --byte-latency-us N   emulated delay for every byte of a reply\n"
+            "  --reply-latency-ms N  emulated firmware processing time\n"
+            "  --output FILE         write the JSON report to FILE instead of stdout\n",
+            name);
+}
+
+/* ************************************************************************************ */
+
+int main(int argc, char *argv[])
+{
+    AstrofocusEmulatorConfig config;
+    int iterations = 100;
+    double duration = 3;
+    const char *output_path = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const bool has_value = (i + 1 < argc);
+
+        if (!strcmp(argv[i], "--iterations") && has_value)
+            iterations = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--duration") && has_value)
+            duration = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--byte-latency-us") && has_value)
+            config.byteLatencyUs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reply-latency-ms") && has_value)
+            config.replyLatencyMs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--output") && has_value)
+            output_path = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    FILE *out = openReport(output_path);
+
+    if (out == nullptr || !muteStdout())
+    {
+        perror("bench_astrofocus");
+        return EXIT_FAILURE;
+    }
+
+    AstrofocusEmulator emulator(config);
+
+    if (!emulator.open())
+        return EXIT_FAILURE;
+
+    std::thread firmware(&AstrofocusEmulator::run, &emulator);
+    AstrofocusBench bench;
+
+    if (!bench.connect(emulator.devicePath()))
+    {
+        emulator.stop();
+        firmware.join();
+        return EXIT_FAILURE;
+    }
+
+    const LatencyStats connect = bench.benchConnect(std::max(1, iterations / 10));
+    const LatencyStats position = bench.benchPositionQuery(iterations);
+    const LatencyStats move = bench.benchMove(iterations);
+    const LatencyStats settings = bench.benchSettingsWrite(iterations);
+    const double throughput = bench.benchPollThroughput(duration);
+
+    bench.disconnect();
+    emulator.stop();
+    firmware.join();
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"byte_latency_us\": %d,\n", config.byteLatencyUs);
+    fprintf(out, "  \"reply_latency_ms\": %d,\n", config.replyLatencyMs);
+    fprintf(out, "  \"latency\": {\n");
+    printStats(out, "connect", connect, false);
+    printStats(out, "position_query", position, false);
+    printStats(out, "move", move, false);
+    printStats(out, "settings_write", settings, true);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"position_polls_per_second\": %.1f\n", throughput);
+    fprintf(out, "}\n");
+    fclose(out);
+
+    return (connect.lost + position.lost + move.lost + settings.lost) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,120 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef LOCKFREE_QUEUE_H
+
+    #define LOCKFREE_QUEUE_H
+
+    #include <atomic>
+    #include <cstddef>
+    #include <cstdint>
+
+    /**
+     * Bounded lock-free queue, safe for many producers and one consumer.
+     * Every slot carries a sequence number that tells producers and the
+     * consumer whose turn it is, so no locks are ever taken.
+     * Capacity must be a power of two.
+     */
+    template <typename T, size_t Capacity>
+    class LockFreeQueue
+    {
+        static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+        public:
+            LockFreeQueue()
+            {
+                for (size_t i = 0; i < Capacity; i++)
+                    slots[i].sequence.store(i, std::memory_order_relaxed);
+            }
+
+            LockFreeQueue(const LockFreeQueue &) = delete;
+            LockFreeQueue &operator=(const LockFreeQueue &) = delete;
+
+            // Returns false if the queue is full
+            bool push(const T &item)
+            {
+                size_t position = tail.load(std::memory_order_relaxed);
+                Slot *slot;
+
+                for (;;)
+                {
+                    slot = &slots[position & (Capacity - 1)];
+                    size_t sequence = slot->sequence.load(std::memory_order_acquire);
+                    intptr_t diff = (intptr_t)sequence - (intptr_t)position;
+
+                    if (diff == 0)
+                    {
+                        if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                            break;
+                    }
+                    else if (diff < 0)
+                        return false;
+                    else
+                        position = tail.load(std::memory_order_relaxed);
+                }
+
+                slot->item = item;
+                slot->sequence.store(position + 1, std::memory_order_release);
+
+                return true;
+            }
+
+            // Returns false if the queue is empty, only one thread may pop
+            bool pop(T &item)
+            {
+                size_t position = head.load(std::memory_order_relaxed);
+                Slot *slot = &slots[position & (Capacity - 1)];
+                size_t sequence = slot->sequence.load(std::memory_order_acquire);
+
+                if ((intptr_t)sequence - (intptr_t)(position + 1) < 0)
+                    return false;
+
+                item = slot->item;
+                slot->sequence.store(position + Capacity, std::memory_order_release);
+                head.store(position + 1, std::memory_order_relaxed);
+
+                return true;
+            }
+
+            // Free slots, exact when there is only one producer, a lower bound otherwise
+            size_t available() const
+            {
+                return Capacity - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+            }
+
+            bool empty() const
+            {
+                size_t position = head.load(std::memory_order_relaxed);
+                return slots[position & (Capacity - 1)].sequence.load(std::memory_order_acquire) != position + 1;
+            }
+
+        private:
+            struct Slot
+            {
+                std::atomic<size_t> sequence;
+                T item;
+            };
+
+            Slot slots[Capacity];
+
+            // Producers and the consumer touch different cache lines
+            std::atomic<size_t> tail { 0 };
+            char padding[64 - sizeof(std::atomic<size_t>)];
+            std::atomic<size_t> head { 0 };
+    };
+#endif
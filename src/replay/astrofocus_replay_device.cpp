@@ -0,0 +1,339 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+
+#include "../astrofocus_protocol.h"
+#include "../astrofocus_session.h"
+#include "astrofocus_replay_device.h"
+
+// Moves and settings writes, the commands acknowledged with "OK"
+static bool isAction(const std::string &command)
+{
+    int code = 0, argument = 0;
+
+    return parseCommand(command, &code, &argument) && isValidCommand(code, argument) && !isQuery(code, argument) &&
+           replyType(code, argument) == REPLY_OK;
+}
+
+/**************************************************************************************
+ ** Script
+ ***************************************************************************************/
+bool ReplayScript::load(const char *path)
+{
+    AstrofocusSessionReader reader;
+    AstrofocusSessionReader::Record record;
+    std::string sent, received;
+    std::deque<size_t> waiting;
+    size_t end;
+
+    if (!reader.open(path))
+        return false;
+
+    while (reader.next(record))
+    {
+        durationUs = record.timeUs;
+
+        if (record.direction == SESSION_TO_DEVICE)
+        {
+            // The driver only writes once the previous batch is over, what is still waiting has timed out
+            waiting.clear();
+            sent.append(record.data, record.length);
+
+            while ((end = sent.find('\n')) != std::string::npos)
+            {
+                ReplayExchange exchange;
+
+                exchange.command = sent.substr(0, end);
+                exchange.action = isAction(exchange.command);
+                exchange.sentUs = record.timeUs;
+
+                if (exchange.action)
+                    actions.push_back(exchanges.size());
+
+                exchange.epoch = actions.size();
+
+                waiting.push_back(exchanges.size());
+                exchanges.push_back(exchange);
+                sent.erase(0, end + 1);
+            }
+        }
+        else
+        {
+            received.append(record.data, record.length);
+
+            // Replies are matched by position, as the driver does, a late one answers the next command
+            while ((end = received.find('\n')) != std::string::npos)
+            {
+                if (waiting.empty())
+                    strayReplies++;
+                else
+                {
+                    ReplayExchange &exchange = exchanges[waiting.front()];
+
+                    exchange.reply = received.substr(0, end);
+                    exchange.answered = true;
+                    exchange.latencyUs = record.timeUs - exchange.sentUs;
+                    waiting.pop_front();
+                }
+
+                received.erase(0, end + 1);
+            }
+        }
+    }
+
+    truncated = reader.isTruncated();
+
+    return true;
+}
+
+/**************************************************************************************
+ ** Constructor
+ ***************************************************************************************/
+AstrofocusReplayDevice::AstrofocusReplayDevice(const ReplayScript &script, bool fast) : script(script), fast(fast)
+{
+    for (size_t i = 0; i < script.exchanges.size(); i++)
+    {
+        if (!script.exchanges[i].action)
+            queries[script.exchanges[i].command].push_back(i);
+    }
+}
+
+/**************************************************************************************
+ ** Distructor
+ ***************************************************************************************/
+AstrofocusReplayDevice::~AstrofocusReplayDevice()
+{
+    if (masterFD != -1)
+        close(masterFD);
+
+    if (slaveFD != -1)
+        close(slaveFD);
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusReplayDevice::open()
+{
+    struct termios tty;
+
+    masterFD = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (masterFD == -1 || grantpt(masterFD) != 0 || unlockpt(masterFD) != 0)
+    {
+        perror("AstrofocusReplayDevice::open => posix_openpt");
+        return false;
+    }
+
+    slavePath = ptsname(masterFD);
+
+    // Same as the emulator: the slave stays open across reconnects, and raw
+    slaveFD = ::open(slavePath.c_str(), O_RDWR | O_NOCTTY);
+
+    if (slaveFD == -1 || tcgetattr(slaveFD, &tty) != 0)
+    {
+        perror("AstrofocusReplayDevice::open => slave");
+        return false;
+    }
+
+    cfmakeraw(&tty);
+    tcsetattr(slaveFD, TCSANOW, &tty);
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+const char * AstrofocusReplayDevice::devicePath() const
+{
+    return slavePath.c_str();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusReplayDevice::run()
+{
+    std::string line;
+    char buffer[256];
+
+    running = true;
+
+    while (running)
+    {
+        struct pollfd pfd = { masterFD, POLLIN, 0 };
+
+        if (poll(&pfd, 1, 10) <= 0)
+            continue;
+
+        const int64_t received_us = nowUs();
+        ssize_t nbytes_read = read(masterFD, buffer, sizeof(buffer));
+
+        if (nbytes_read <= 0)
+        {
+            // EIO only means nobody has the slave open right now
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        for (ssize_t i = 0; i < nbytes_read; i++)
+        {
+            if (buffer[i] != '\n')
+            {
+                line += buffer[i];
+                continue;
+            }
+
+            serve(line, received_us);
+            line.clear();
+        }
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusReplayDevice::stop()
+{
+    running = false;
+}
+
+/* ************************************************************************************ */
+
+ReplayCounters AstrofocusReplayDevice::counters() const
+{
+    ReplayCounters result = stats;
+
+    // What the replay never got to is skipped as well
+    result.skipped += script.actions.size() - nextAction;
+
+    for (const auto &recorded : queries)
+    {
+        auto cursor = queryCursor.find(recorded.first);
+
+        result.skipped += recorded.second.size() - (cursor != queryCursor.end() ? cursor->second : 0);
+    }
+
+    return result;
+}
+
+/**************************************************************************************
+ ** Matching
+ ***************************************************************************************/
+void AstrofocusReplayDevice::serve(const std::string &command, int64_t receivedUs)
+{
+    const int index = isAction(command) ? matchAction(command) : matchQuery(command);
+
+    if (index < 0)
+    {
+        // Left unanswered, the driver sees a timeout as it would with a silent device
+        fprintf(stderr, "AstrofocusReplayDevice::serve => No recorded answer for %s\n", command.c_str());
+        stats.unmatched++;
+        return;
+    }
+
+    if (script.exchanges[index].answered)
+        sendReply(script.exchanges[index], receivedUs);
+}
+
+/* ************************************************************************************ */
+
+int AstrofocusReplayDevice::matchAction(const std::string &command)
+{
+    for (size_t i = nextAction; i < script.actions.size(); i++)
+    {
+        const size_t index = script.actions[i];
+
+        if (script.exchanges[index].command != command)
+            continue;
+
+        stats.skipped += i - nextAction;
+        stats.served++;
+
+        nextAction = i + 1;
+        epoch = script.exchanges[index].epoch;
+
+        return index;
+    }
+
+    return -1;
+}
+
+/* ************************************************************************************ */
+
+int AstrofocusReplayDevice::matchQuery(const std::string &command)
+{
+    auto found = queries.find(command);
+
+    if (found == queries.end())
+        return -1;
+
+    const std::vector<size_t> &recorded = found->second;
+    size_t &cursor = queryCursor[command];
+    int &last = lastQuery.emplace(command, -1).first->second;
+
+    // Asked less often than recorded: the answers of the actions already past are stale
+    while (cursor < recorded.size() && script.exchanges[recorded[cursor]].epoch < epoch)
+    {
+        last = recorded[cursor++];
+        stats.skipped++;
+    }
+
+    if (cursor < recorded.size() && script.exchanges[recorded[cursor]].epoch == epoch)
+    {
+        last = recorded[cursor++];
+        stats.served++;
+        return last;
+    }
+
+    // Asked more often than recorded: the last answer still holds, or the first one if there is none yet
+    stats.repeated++;
+
+    return last >= 0 ? last : (int)recorded[cursor];
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusReplayDevice::sendReply(const ReplayExchange &exchange, int64_t receivedUs)
+{
+    const std::string line = exchange.reply + "\n";
+
+    if (!fast)
+    {
+        const int64_t wait_us = receivedUs + (int64_t)exchange.latencyUs - nowUs();
+
+        if (wait_us > 0)
+            std::this_thread::sleep_for(std::chrono::microseconds(wait_us));
+    }
+
+    if (write(masterFD, line.data(), line.size()) < 0)
+        perror("AstrofocusReplayDevice::sendReply => write");
+}
+
+/* ************************************************************************************ */
+
+int64_t AstrofocusReplayDevice::nowUs() const
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
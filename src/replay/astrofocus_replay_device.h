@@ -0,0 +1,113 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_REPLAY_DEVICE_H
+
+    #define ASTROFOCUS_REPLAY_DEVICE_H
+
+    #include <atomic>
+    #include <cstdint>
+    #include <map>
+    #include <string>
+    #include <vector>
+
+    /**
+     * One command of a recorded session, with the line the firmware answered
+     * and how long it took. Actions are the commands that change the state
+     * of the device (moves, settings writes): the queries in between are
+     * answered with what the device was saying at that point of the session.
+     */
+    struct ReplayExchange
+    {
+        std::string command;
+        std::string reply;          // Raw line, without the '\n'
+        bool answered { false };    // False if the driver timed out on it
+        bool action { false };
+        int epoch { 0 };            // Actions sent up to this command, included
+        uint64_t sentUs { 0 };      // Since the start of the session
+        uint64_t latencyUs { 0 };   // To the end of the reply
+    };
+
+    struct ReplayScript
+    {
+        std::vector<ReplayExchange> exchanges;
+        std::vector<size_t> actions;    // Indexes of the actions, in order
+        uint64_t durationUs { 0 };
+        int strayReplies { 0 };         // Lines read while no command was waiting
+        bool truncated { false };
+
+        bool load(const char *path);
+    };
+
+    struct ReplayCounters
+    {
+        int served { 0 };       // Answered with the recorded reply, in order
+        int repeated { 0 };     // Queries asked more often than recorded, answered with the closest reply
+        int skipped { 0 };      // Recorded commands the driver never sent
+        int unmatched { 0 };    // Commands the recording has no answer for
+    };
+
+    /**
+     * Plays a recorded session back on the master side of a
+     * pseudo-terminal. The driver is matched on the command text, not on
+     * the order alone, so the idle polls may drift in number from the
+     * recording without breaking the replay, while the actions have to come
+     * in the recorded order. Replies are delayed as recorded, or sent at
+     * once in fast mode.
+     */
+    class AstrofocusReplayDevice
+    {
+        public:
+            AstrofocusReplayDevice(const ReplayScript &script, bool fast);
+            ~AstrofocusReplayDevice();
+
+            // Creates the pseudo-terminal, devicePath() is then the port to use
+            bool open();
+            const char *devicePath() const;
+
+            // Serves the commands until stop() is called
+            void run();
+            void stop();
+
+            // Only meaningful once run() has returned
+            ReplayCounters counters() const;
+
+        private:
+            void serve(const std::string &command, int64_t receivedUs);
+            int matchAction(const std::string &command);
+            int matchQuery(const std::string &command);
+            void sendReply(const ReplayExchange &exchange, int64_t receivedUs);
+            int64_t nowUs() const;
+
+            const ReplayScript &script;
+            bool fast;
+
+            int masterFD { -1 };
+            int slaveFD { -1 };
+            std::string slavePath;
+            std::atomic<bool> running { false };
+
+            size_t nextAction { 0 };
+            int epoch { 0 };
+            std::map<std::string, std::vector<size_t>> queries;     // Recorded queries by command text, in order
+            std::map<std::string, size_t> queryCursor;
+            std::map<std::string, int> lastQuery;                   // Last one served, or skipped
+
+            ReplayCounters stats;
+    };
+#endif
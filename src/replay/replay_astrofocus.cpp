@@ -0,0 +1,462 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <thread>
+#include <unistd.h>
+
+#include <eventloop.h>
+#include <indicom.h>
+
+#include "../astrofocus_focuser.h"
+#include "../bench/astrofocus_report.h"
+#include "astrofocus_replay_device.h"
+
+#define REPLAY_IDLE_TIMEOUT_MS  60000   // An action the focuser is still busy with after this long is counted as lost
+#define REPLAY_SLICE_MS         5       // Event loop granularity while waiting
+
+typedef std::chrono::steady_clock Clock;
+
+/**
+ * Drives a real AstrofocusFocuser through a recorded session: the replay
+ * device answers as the firmware did, this side issues the recorded
+ * actions again through the same entry points the clients reach. Moves go
+ * through MoveAbsFocuser(), settings through applySettings(), anything else
+ * is posted to the serial worker as it was.
+ */
+class AstrofocusReplay
+{
+    public:
+        AstrofocusReplay(const ReplayScript &script, bool fast);
+
+        bool connect(const char *port);
+        void disconnect();
+        void run();
+
+        const LatencyStats &actionLatency() const;
+        int failedActions() const;
+
+    private:
+        void seedSnapshot();
+        bool issue(const ReplayExchange &action);
+        bool isIdle() const;
+        void pump(Clock::time_point until, bool untilIdle);
+
+        const ReplayScript &script;
+        bool fast;
+
+        AstrofocusFocuser focuser;
+        Clock::time_point connected;
+
+        bool measuring { false };
+        Clock::time_point issued;
+        LatencyStats latency;
+        int failed { 0 };
+};
+
+/* ************************************************************************************ */
+
+AstrofocusReplay::AstrofocusReplay(const ReplayScript &script, bool fast) : script(script), fast(fast)
+{
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusReplay::connect(const char *port)
+{
+    focuser.initProperties();
+
+    if (tty_connect(port, 9600, 8, 0, 1, &focuser.PortFD) != TTY_OK)
+    {
+        fprintf(stderr, "replay_astrofocus: unable to open %s\n", port);
+        return false;
+    }
+
+    seedSnapshot();
+
+    // The session clock starts with the handshake, as the recording did
+    connected = Clock::now();
+
+    if (!focuser.Handshake())
+        return false;
+
+    focuser.setConnected(true);
+
+    return focuser.updateProperties();
+}
+
+/* ************************************************************************************ */
+
+/**
+ * A session that connected from a snapshot only read the position, the
+ * upper limit and the temperature back. Without the same snapshot the
+ * driver would read every setting, and the recording can't answer that.
+ */
+void AstrofocusReplay::seedSnapshot()
+{
+    const ReplayExchange *version = nullptr;
+    const ReplayExchange *limit = nullptr;
+    bool has_sensor = false;
+
+    for (const ReplayExchange &exchange : script.exchanges)
+    {
+        // A full load reads the step size with the rest of the settings
+        if (exchange.command == commandText<COMMAND_STEP_SIZE, 0>())
+            return;
+
+        if (exchange.action)
+            break;
+
+        if (exchange.command == commandText<COMMAND_VERSION, 0>() && version == nullptr)
+            version = &exchange;
+        else if (exchange.command == commandText<COMMAND_UPPER_LIMIT, 0>() && limit == nullptr)
+            limit = &exchange;
+        else if (exchange.command == commandText<COMMAND_TEMPERATURE, 1>())
+            has_sensor = true;
+    }
+
+    if (version == nullptr || limit == nullptr || !version->answered || !limit->answered)
+        return;
+
+    Expected<int> upper_limit = decodeReply<COMMAND_UPPER_LIMIT>(limit->reply);
+    AstrofocusSettingsCache cache;
+    AstrofocusSnapshot snapshot;
+
+    if (!upper_limit)
+        return;
+
+    cache.set(COMMAND_UPPER_LIMIT, upper_limit.value);
+    cache.set(COMMAND_TEMPERATURE, has_sensor ? 1 : 0);
+    snapshot.capture(cache, version->reply.c_str());
+    snapshot.save(focuser.snapshotPath().c_str());
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusReplay::disconnect()
+{
+    focuser.setConnected(false);
+    focuser.updateProperties();
+
+    tty_disconnect(focuser.PortFD);
+    focuser.PortFD = -1;
+}
+
+/* ************************************************************************************ */
+
+const LatencyStats &AstrofocusReplay::actionLatency() const
+{
+    return latency;
+}
+
+int AstrofocusReplay::failedActions() const
+{
+    return failed;
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusReplay::isIdle() const
+{
+    return !focuser.moveInProgress && !focuser.moveCommandPending && !focuser.abortPending &&
+           focuser.settingsTransaction.count == 0 && focuser.queuedSettingsCount == 0;
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusReplay::pump(Clock::time_point until, bool untilIdle)
+{
+    int never = 0;
+
+    while (Clock::now() < until)
+    {
+        IEDeferLoop(REPLAY_SLICE_MS, &never);
+
+        // The latency of an action runs until the focuser is idle again
+        if (measuring && isIdle())
+        {
+            latency.samples.push_back(std::chrono::duration<double, std::milli>(Clock::now() - issued).count());
+            measuring = false;
+
+            if (focuser.FocusAbsPosNP.s == IPS_ALERT)
+                failed++;
+        }
+
+        if (untilIdle && isIdle())
+            return;
+    }
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusReplay::issue(const ReplayExchange &action)
+{
+    int code = 0, argument = 0;
+
+    parseCommand(action.command, &code, &argument);
+
+    switch (code)
+    {
+        case COMMAND_GOTO:
+            focuser.FocusAbsPosNP.s = IPS_BUSY;
+            return focuser.MoveAbsFocuser(argument) != IPS_ALERT;
+
+        case COMMAND_TEMPERATURE_COMPENSATION:
+            return focuser.serialWorker.post(AstrofocusSerialWorker::REQUEST_COMMAND, AstrofocusFocuser::SERIAL_TAG_TEMPERATURE_COMPENSATION,
+                                             action.command.c_str());
+
+        default:
+            if (AstrofocusFocuser::isWritableSetting(code, argument))
+            {
+                const AstrofocusFocuser::SettingsWrite write = { code, argument };
+
+                return focuser.applySettings(&write, 1);
+            }
+
+            // Relative moves and limits, no transaction to go through
+            return focuser.serialWorker.post(AstrofocusSerialWorker::REQUEST_COMMAND, AstrofocusFocuser::SERIAL_TAG_SETTINGS_WRITE,
+                                             action.command.c_str());
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusReplay::run()
+{
+    for (size_t index : script.actions)
+    {
+        const ReplayExchange &action = script.exchanges[index];
+
+        // At the recorded time, or as soon as the previous action is over
+        if (fast)
+            pump(Clock::now() + std::chrono::milliseconds(REPLAY_IDLE_TIMEOUT_MS), true);
+        else
+            pump(connected + std::chrono::microseconds(action.sentUs), false);
+
+        // Still busy: in fast mode the wait has timed out, with the recorded timing the session overtook it as well
+        if (measuring)
+        {
+            if (fast)
+                latency.lost++;
+
+            measuring = false;
+        }
+
+        issued = Clock::now();
+
+        if (!issue(action))
+        {
+            fprintf(stderr, "replay_astrofocus: unable to issue %s\n", action.command.c_str());
+            failed++;
+            continue;
+        }
+
+        measuring = true;
+    }
+
+    if (!fast)
+        pump(connected + std::chrono::microseconds(script.durationUs), false);
+
+    pump(Clock::now() + std::chrono::milliseconds(REPLAY_IDLE_TIMEOUT_MS), true);
+
+    if (measuring)
+    {
+        latency.lost++;
+        measuring = false;
+    }
+}
+
+/**************************************************************************************
+ ** Report
+ ***************************************************************************************/
+static AstrofocusReplayDevice *served = nullptr;
+
+static void onSignal(int)
+{
+    if (served != nullptr)
+        served->stop();
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options] SESSION\n"
+            "  --fast                reply at once instead of with the recorded latencies\n"
+            "  --serve               only serve the session on a pseudo-terminal, for a driver run by hand\n"
+            "  --link PATH           with --serve, symlink PATH to the pseudo-terminal\n"
+            "  --output FILE         write the JSON report to FILE instead of stdout\n",
+            name);
+}
+
+/* ************************************************************************************ */
+
+int main(int argc, char *argv[])
+{
+    const char *session_path = nullptr;
+    const char *output_path = nullptr;
+    const char *link_path = nullptr;
+    bool fast = false;
+    bool serve_only = false;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const bool has_value = (i + 1 < argc);
+
+        if (!strcmp(argv[i], "--fast"))
+            fast = true;
+        else if (!strcmp(argv[i], "--serve"))
+            serve_only = true;
+        else if (!strcmp(argv[i], "--link") && has_value)
+            link_path = argv[++i];
+        else if (!strcmp(argv[i], "--output") && has_value)
+            output_path = argv[++i];
+        else if (argv[i][0] != '-' && session_path == nullptr)
+            session_path = argv[i];
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (session_path == nullptr)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    ReplayScript script;
+
+    if (!script.load(session_path))
+    {
+        fprintf(stderr, "replay_astrofocus: %s is not a session file\n", session_path);
+        return EXIT_FAILURE;
+    }
+
+    if (script.truncated)
+        fprintf(stderr, "replay_astrofocus: %s is truncated, replaying what is complete\n", session_path);
+
+    FILE *out = openReport(output_path);
+
+    if (out == nullptr)
+    {
+        perror("replay_astrofocus");
+        return EXIT_FAILURE;
+    }
+
+    AstrofocusReplayDevice device(script, fast);
+
+    if (!device.open())
+        return EXIT_FAILURE;
+
+    const auto start = Clock::now();
+    LatencyStats latency;
+    int failed = 0;
+
+    if (serve_only)
+    {
+        if (link_path != nullptr)
+        {
+            unlink(link_path);
+
+            if (symlink(device.devicePath(), link_path) != 0)
+            {
+                perror("symlink");
+                return EXIT_FAILURE;
+            }
+        }
+
+        served = &device;
+        signal(SIGINT, onSignal);
+        signal(SIGTERM, onSignal);
+
+        fprintf(stderr, "%s\n", link_path != nullptr ? link_path : device.devicePath());
+        device.run();
+
+        if (link_path != nullptr)
+            unlink(link_path);
+    }
+    else
+    {
+        if (!muteStdout())
+        {
+            perror("replay_astrofocus");
+            return EXIT_FAILURE;
+        }
+
+        // A private home: no configuration, no snapshot, the driver connects the same way every time
+        char home[] = "/tmp/replay_astrofocus.XXXXXX";
+
+        if (mkdtemp(home) == nullptr)
+        {
+            perror("replay_astrofocus");
+            return EXIT_FAILURE;
+        }
+
+        setenv("HOME", home, 1);
+        unsetenv(CAPTURE_ENV);
+        std::filesystem::create_directory(std::string(home) + "/.indi");
+
+        std::thread firmware(&AstrofocusReplayDevice::run, &device);
+
+        {
+            AstrofocusReplay replay(script, fast);
+
+            if (replay.connect(device.devicePath()))
+                replay.run();
+            else
+                failed++;
+
+            replay.disconnect();
+
+            latency = replay.actionLatency();
+            failed += replay.failedActions();
+        }
+
+        device.stop();
+        firmware.join();
+
+        std::filesystem::remove_all(home);
+    }
+
+    const ReplayCounters counters = device.counters();
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"session\": \"%s\",\n", session_path);
+    fprintf(out, "  \"timing\": \"%s\",\n", fast ? "fast" : "recorded");
+    fprintf(out, "  \"recorded_ms\": %.1f,\n", script.durationUs / 1000.0);
+    fprintf(out, "  \"replayed_ms\": %.1f,\n", std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+    fprintf(out, "  \"exchanges\": %zu,\n", script.exchanges.size());
+    fprintf(out, "  \"actions\": %zu,\n", script.actions.size());
+    fprintf(out, "  \"served\": %d,\n", counters.served);
+    fprintf(out, "  \"repeated\": %d,\n", counters.repeated);
+    fprintf(out, "  \"skipped\": %d,\n", counters.skipped);
+    fprintf(out, "  \"unmatched\": %d,\n", counters.unmatched);
+    fprintf(out, "  \"failed_actions\": %d,\n", failed);
+    fprintf(out, "  \"action_latency\": { \"samples\": %zu, \"lost\": %d, \"p50_ms\": %.3f, \"p99_ms\": %.3f, \"max_ms\": %.3f }\n",
+            latency.samples.size(), latency.lost, latency.percentile(0.5), latency.percentile(0.99), latency.max());
+    fprintf(out, "}\n");
+    fclose(out);
+
+    return (counters.unmatched + failed + latency.lost) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,372 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+
+#include "../astrofocus_protocol.h"
+#include "astrofocus_emulator.h"
+
+/**************************************************************************************
+ ** Constructor
+ ***************************************************************************************/
+AstrofocusEmulator::AstrofocusEmulator(const AstrofocusEmulatorConfig &config) : config(config), random(config.seed)
+{
+    position = target = config.initialPosition;
+    upperLimit = config.upperLimit;
+    startTime = lastUpdate = std::chrono::steady_clock::now();
+}
+
+/**************************************************************************************
+ ** Distructor
+ ***************************************************************************************/
+AstrofocusEmulator::~AstrofocusEmulator()
+{
+    if (masterFD != -1)
+        close(masterFD);
+
+    if (slaveFD != -1)
+        close(slaveFD);
+}
+
+/* ************************************************************************************ */
+
+bool AstrofocusEmulator::open()
+{
+    struct termios tty;
+
+    masterFD = posix_openpt(O_RDWR | O_NOCTTY);
+
+    if (masterFD == -1 || grantpt(masterFD) != 0 || unlockpt(masterFD) != 0)
+    {
+        perror("AstrofocusEmulator::open => posix_openpt");
+        return false;
+    }
+
+    slavePath = ptsname(masterFD);
+
+    // Keeping the slave open makes the pty survive the driver disconnecting, raw mode stops
+    // the line discipline from echoing the replies back as commands
+    slaveFD = ::open(slavePath.c_str(), O_RDWR | O_NOCTTY);
+
+    if (slaveFD == -1 || tcgetattr(slaveFD, &tty) != 0)
+    {
+        perror("AstrofocusEmulator::open => slave");
+        return false;
+    }
+
+    cfmakeraw(&tty);
+    tcsetattr(slaveFD, TCSANOW, &tty);
+
+    return true;
+}
+
+/* ************************************************************************************ */
+
+const char * AstrofocusEmulator::devicePath() const
+{
+    return slavePath.c_str();
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusEmulator::run()
+{
+    std::string line;
+    char buffer[256];
+
+    running = true;
+
+    while (running)
+    {
+        struct pollfd pfd = { masterFD, POLLIN, 0 };
+
+        updateState();
+
+        if (poll(&pfd, 1, 10) <= 0)
+            continue;
+
+        ssize_t nbytes_read = read(masterFD, buffer, sizeof(buffer));
+
+        if (nbytes_read <= 0)
+        {
+            // EIO only means nobody has the slave open right now
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            continue;
+        }
+
+        for (ssize_t i = 0; i < nbytes_read; i++)
+        {
+            if (buffer[i] == '\r')
+                continue;
+
+            if (buffer[i] != '\n')
+            {
+                line += buffer[i];
+                continue;
+            }
+
+            if (config.replyLatencyMs > 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(config.replyLatencyMs));
+
+            updateState();
+            sendReply(execute(line));
+            line.clear();
+        }
+    }
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusEmulator::stop()
+{
+    running = false;
+}
+
+/**************************************************************************************
+ ** Firmware
+ ***************************************************************************************/
+std::string AstrofocusEmulator::execute(const std::string &command)
+{
+    int code = 0, argument = 0;
+    char reply[64];
+
+    if (!parseCommand(command, &code, &argument))
+        return "ERR";
+
+    switch (code)
+    {
+        case COMMAND_POSITION:
+            if (argument == 0)
+            {
+                snprintf(reply, sizeof(reply), "%d", (int)std::lround(position));
+                return reply;
+            }
+
+            position = target = argument;
+            return "OK";
+
+        case COMMAND_GOTO:
+            target = std::max(0, std::min(upperLimit, argument));
+            return "OK";
+
+        case COMMAND_MOVE_RELATIVE:
+            target = (int)std::lround(position) + argument;
+            return "OK";
+
+        case COMMAND_SET_LOWER_LIMIT:
+            upperLimit -= (int)std::lround(position);
+            position = target = 0;
+            return "OK";
+
+        case COMMAND_UPPER_LIMIT:
+            if (argument == 0)
+            {
+                snprintf(reply, sizeof(reply), "%d", upperLimit);
+                return reply;
+            }
+
+            upperLimit = (argument == 1) ? (int)std::lround(position) : argument;
+            return "OK";
+
+        case COMMAND_TEMPERATURE:
+            if (argument == 0)
+                return config.hasTemperatureSensor ? "T" : "F";
+
+            if (argument == 1 && config.hasTemperatureSensor)
+            {
+                snprintf(reply, sizeof(reply), "%.2f", readTemperature());
+                return reply;
+            }
+
+            return "ERR";
+
+        case COMMAND_TEMPERATURE_COEFFICIENT:
+            if (argument == 0)
+            {
+                snprintf(reply, sizeof(reply), "%d", temperatureCoefficient);
+                return reply;
+            }
+
+            temperatureCoefficient = argument;
+            return "OK";
+
+        case COMMAND_TEMPERATURE_COMPENSATION:
+            if (argument != 0 && argument != 1)
+                return "ERR";
+
+            temperatureCompensation = (argument == 1);
+            compensationReference = readTemperature();
+            return "OK";
+
+        case COMMAND_STEP_SIZE:
+            if (argument == 0)
+            {
+                snprintf(reply, sizeof(reply), "%d", stepSize);
+                return reply;
+            }
+
+            stepSize = argument;
+            return "OK";
+
+        case COMMAND_VERSION:
+            return EMULATOR_VERSION;
+
+        case COMMAND_STEPPER_POWER:
+            if (argument == 0)
+            {
+                snprintf(reply, sizeof(reply), "%d", stepperPower);
+                return reply;
+            }
+
+            if (argument < 1 || argument > 255)
+                return "ERR";
+
+            stepperPower = argument;
+            return "OK";
+
+        case COMMAND_PULSES_DURATION:
+            if (argument == 0)
+            {
+                snprintf(reply, sizeof(reply), "%d", pulsesDuration);
+                return reply;
+            }
+
+            pulsesDuration = argument;
+            return "OK";
+
+        case COMMAND_PAUSE:
+            if (argument == 0)
+            {
+                snprintf(reply, sizeof(reply), "%d", powerCutPause);
+                return reply;
+            }
+
+            powerCutPause = argument;
+            return "OK";
+
+        case COMMAND_MOTION_MODE:
+            if (argument == 0)
+            {
+                snprintf(reply, sizeof(reply), "%d", motionMode);
+                return reply;
+            }
+
+            if (argument < 1 || argument > 3)
+                return "ERR";
+
+            motionMode = argument;
+            return "OK";
+    }
+
+    return "ERR";
+}
+
+/* ************************************************************************************ */
+
+double AstrofocusEmulator::stepPeriodMs() const
+{
+    // Half step mode needs half of the pulse to cover one position unit
+    return std::max(0.01, motionMode == 3 ? pulsesDuration / 2.0 : (double)pulsesDuration);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusEmulator::updateState()
+{
+    const auto now = std::chrono::steady_clock::now();
+    const double elapsed_ms = std::chrono::duration<double, std::milli>(now - lastUpdate).count();
+
+    lastUpdate = now;
+
+    // The firmware compensation shifts the target as the temperature changes
+    if (temperatureCompensation && config.hasTemperatureSensor && position == target)
+    {
+        const double temperature = readTemperature();
+        const int correction = (int)std::lround(temperatureCoefficient * (temperature - compensationReference));
+
+        if (correction != 0)
+        {
+            target = std::max(0, std::min(upperLimit, target + correction));
+            compensationReference = temperature;
+        }
+    }
+
+    if (position == target)
+        return;
+
+    const double steps = elapsed_ms / stepPeriodMs();
+
+    if (std::abs(target - position) <= steps)
+        position = target;
+    else
+        position += (target > position) ? steps : -steps;
+}
+
+/* ************************************************************************************ */
+
+double AstrofocusEmulator::readTemperature()
+{
+    std::normal_distribution<double> noise(0, config.temperatureNoise);
+    const double hours = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count() / 3600.;
+
+    return config.ambientTemperature + config.temperatureDrift * hours + (config.temperatureNoise > 0 ? noise(random) : 0);
+}
+
+/* ************************************************************************************ */
+
+void AstrofocusEmulator::sendReply(const std::string &reply)
+{
+    std::uniform_real_distribution<double> chance(0, 1);
+    std::string line = reply + "\n";
+
+    if (config.dropRate > 0 && chance(random) < config.dropRate)
+        return;
+
+    if (config.garbleRate > 0 && chance(random) < config.garbleRate)
+    {
+        std::uniform_int_distribution<size_t> where(0, line.size() - 1);
+        line[where(random)] = (char)0xfe;
+    }
+
+    if (config.byteLatencyUs <= 0)
+    {
+        if (write(masterFD, line.data(), line.size()) < 0)
+            perror("AstrofocusEmulator::sendReply => write");
+        return;
+    }
+
+    for (char c : line)
+    {
+        std::this_thread::sleep_for(std::chrono::microseconds(config.byteLatencyUs));
+
+        if (write(masterFD, &c, 1) < 0)
+        {
+            perror("AstrofocusEmulator::sendReply => write");
+            return;
+        }
+    }
+}
@@ -0,0 +1,98 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#ifndef ASTROFOCUS_EMULATOR_H
+
+    #define ASTROFOCUS_EMULATOR_H
+
+    #include <atomic>
+    #include <chrono>
+    #include <random>
+    #include <string>
+
+    #define EMULATOR_VERSION    "AstroFocus 5 Simulator"
+
+    struct AstrofocusEmulatorConfig
+    {
+        int byteLatencyUs { 0 };            // Delay for every byte sent back, simulates the baud rate
+        int replyLatencyMs { 0 };           // Firmware processing time for every command
+        double dropRate { 0 };              // Probability for a reply to be lost
+        double garbleRate { 0 };            // Probability for a reply to be corrupted
+        bool hasTemperatureSensor { true };
+        double ambientTemperature { 15 };   // Celsius at startup
+        double temperatureDrift { -0.5 };   // Celsius per hour
+        double temperatureNoise { 0.05 };   // Standard deviation of a reading
+        int initialPosition { 5000 };
+        int upperLimit { 10000 };
+        unsigned int seed { 0 };
+    };
+
+    /**
+     * Emulates the AstroFocus 5 firmware on the master side of a
+     * pseudo-terminal, the driver talks to the slave side as if it was the
+     * real serial port. The whole command table is implemented, moves take
+     * one pulse per step (half a pulse in half step mode).
+     */
+    class AstrofocusEmulator
+    {
+        public:
+            explicit AstrofocusEmulator(const AstrofocusEmulatorConfig &config);
+            ~AstrofocusEmulator();
+
+            // Creates the pseudo-terminal, devicePath() is then the port to use
+            bool open();
+            const char *devicePath() const;
+
+            // Serves the commands until stop() is called
+            void run();
+            void stop();
+
+            // Executes one command line, without the terminator, and returns the reply
+            std::string execute(const std::string &command);
+
+        private:
+            void updateState();
+            double readTemperature();
+            void sendReply(const std::string &reply);
+            double stepPeriodMs() const;
+
+            AstrofocusEmulatorConfig config;
+
+            int masterFD { -1 };
+            int slaveFD { -1 };
+            std::string slavePath;
+            std::atomic<bool> running { false };
+
+            std::mt19937 random;
+            std::chrono::steady_clock::time_point startTime;
+            std::chrono::steady_clock::time_point lastUpdate;
+
+            // Firmware state
+            double position { 0 };
+            int target { 0 };
+            int upperLimit { 0 };
+            int temperatureCoefficient { 0 };
+            bool temperatureCompensation { false };
+            double compensationReference { 0 };
+            int stepSize { 100 };
+            int stepperPower { 128 };
+            int pulsesDuration { 5 };
+            int powerCutPause { 1000 };
+            int motionMode { 1 };
+    };
+#endif
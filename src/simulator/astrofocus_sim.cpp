@@ -0,0 +1,112 @@
+/*******************************************************************************
+  Copyright(c) Giacomo Succi. All rights reserved.
+
+ This library is free software; you can redistribute it and/or
+ modify it under the terms of the GNU Library General Public
+ License version 2 as published by the Free Software Foundation.
+ .
+ This library is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ Library General Public License for more details.
+ .
+ You should have received a copy of the GNU Library General Public License
+ along with this library; see the file COPYING.LIB.  If not, write to
+ the Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ Boston, MA 02110-1301, USA.
+*******************************************************************************/
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "astrofocus_emulator.h"
+
+/* ************************************************************************************ */
+
+static AstrofocusEmulator *emulator = nullptr;
+
+static void onSignal(int)
+{
+    if (emulator != nullptr)
+        emulator->stop();
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  --byte-latency-us N   delay for every byte of a reply\n"
+            "  --reply-latency-ms N  firmware processing time for every command\n"
+            "  --drop P              probability [0..1] for a reply to be lost\n"
+            "  --garble P            probability [0..1] for a reply to be corrupted\n"
+            "  --no-sensor           emulate a unit without temperature sensor\n"
+            "  --seed N              seed for the fault injection and the sensor noise\n"
+            "  --link PATH           symlink PATH to the pseudo-terminal\n",
+            name);
+}
+
+/* ************************************************************************************ */
+
+int main(int argc, char *argv[])
+{
+    AstrofocusEmulatorConfig config;
+    const char *link_path = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        const bool has_value = (i + 1 < argc);
+
+        if (!strcmp(argv[i], "--byte-latency-us") && has_value)
+            config.byteLatencyUs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--reply-latency-ms") && has_value)
+            config.replyLatencyMs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--drop") && has_value)
+            config.dropRate = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--garble") && has_value)
+            config.garbleRate = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--no-sensor"))
+            config.hasTemperatureSensor = false;
+        else if (!strcmp(argv[i], "--seed") && has_value)
+            config.seed = (unsigned int)strtoul(argv[++i], nullptr, 10);
+        else if (!strcmp(argv[i], "--link") && has_value)
+            link_path = argv[++i];
+        else
+        {
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    AstrofocusEmulator instance(config);
+
+    if (!instance.open())
+        return EXIT_FAILURE;
+
+    if (link_path != nullptr)
+    {
+        unlink(link_path);
+
+        if (symlink(instance.devicePath(), link_path) != 0)
+        {
+            perror("symlink");
+            return EXIT_FAILURE;
+        }
+    }
+
+    emulator = &instance;
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    printf("%s\n", link_path != nullptr ? link_path : instance.devicePath());
+    fflush(stdout);
+
+    instance.run();
+
+    if (link_path != nullptr)
+        unlink(link_path);
+
+    return EXIT_SUCCESS;
+}